@@ -2,13 +2,80 @@
 
 #pragma once
 
+#include <algorithm> // std::min, std::max
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstring> // std::memcpy
 #include <cstddef> // offsetof
+#include <cstdint>
+#include <exception> // std::terminate
+#include <initializer_list>
+#include <iterator>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <new> // std::hardware_destructive_interference_size
 #include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread> // std::this_thread::yield
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/futex.h>     // FUTEX_WAIT_PRIVATE
+#include <linux/mempolicy.h> // MPOL_BIND
+#include <sys/mman.h>        // mmap
+#include <sys/eventfd.h>     // eventfd
+#include <sys/syscall.h>     // SYS_futex, SYS_mbind, SYS_getcpu
+#include <time.h>        // timespec
+#include <unistd.h>      // syscall
+#else
+#include <condition_variable>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <immintrin.h> // _mm_pause
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>    // O_CREAT
+#include <sys/mman.h> // shm_open, mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // ftruncate
+#endif
+
+// thread sanitizer does not understand fences, under it we synchronize with
+// read-modify-write operations instead
+#if defined(__SANITIZE_THREAD__)
+#define MPMC_THREAD_SANITIZER 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define MPMC_THREAD_SANITIZER 1
+#endif
+#endif
+
+// coroutine awaitables need c++20 coroutines
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define MPMC_HAS_COROUTINES 1
+#include <coroutine>
+#include <optional>
+#endif
+#endif
+
+// warns about a blocking pop whose result is ignored, the item is not
+// written once the queue is closed
+#if defined(__has_cpp_attribute)
+#if __has_cpp_attribute(nodiscard) &&                                          \
+    (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L))
+#define MPMC_NODISCARD [[nodiscard]]
+#endif
+#endif
+#ifndef MPMC_NODISCARD
+#define MPMC_NODISCARD
+#endif
 
 #ifndef __cpp_aligned_new
 #ifdef _WIN32
@@ -20,19 +87,32 @@
 
 namespace mpmc {
 
-#if defined(__cpp_lib_hardware_interference_size) && !defined(__APPLE__)
+// gcc warns with -Winterference-size whenever the std constant is used in a
+// header, since its value depends on -mtune, so gcc gets the fixed value too
+#if defined(__cpp_lib_hardware_interference_size) && !defined(__APPLE__) &&    \
+    !(defined(__GNUC__) && !defined(__clang__))
 static constexpr size_t hardware_interference_size =
     std::hardware_destructive_interference_size;
 #else
 static constexpr size_t hardware_interference_size = 64;
 #endif
 
+/// tickets and turns are 64 bit on every platform. at a billion operations
+/// per second a ticket takes centuries to wrap, so wrapping is never reached
+/// and the turn of a slot never becomes ambiguous, also with 32 bit size_t.
+using ticket_type = std::uint64_t;
+
 #if defined(__cpp_aligned_new)
 template <typename T> using aligned_allocator = std::allocator<T>;
 #else
 template <typename T> struct aligned_allocator {
   using value_type = T;
 
+  aligned_allocator() noexcept = default;
+
+  template <typename U>
+  aligned_allocator(const aligned_allocator<U> &) noexcept {}
+
   T *allocate(std::size_t n) {
     if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
       throw std::bad_array_new_length();
@@ -62,7 +142,206 @@ template <typename T> struct aligned_allocator {
 };
 #endif
 
-template <typename T> struct slot {
+/// allocates memory bound to a numa node. on linux the memory is mapped
+/// directly and bound with mbind so that its pages are placed on the node no
+/// matter which thread touches them first. when mbind fails, as it does on
+/// kernels without numa support or in containers that forbid it, the memory
+/// is left unbound, and elsewhere this falls back to aligned_allocator. a
+/// negative node leaves placement to the kernel.
+template <typename T> class numa_allocator {
+public:
+  using value_type = T;
+
+  explicit numa_allocator(const int node = -1) noexcept : node_(node) {}
+
+  template <typename U>
+  numa_allocator(const numa_allocator<U> &other) noexcept
+      : node_(other.node()) {}
+
+  int node() const noexcept { return node_; }
+
+  /// returns true if memory can be bound to numa nodes on this system
+  static bool available() noexcept {
+#if defined(__linux__)
+    return syscall(SYS_get_mempolicy, nullptr, nullptr, 0UL, nullptr, 0UL) ==
+           0;
+#else
+    return false;
+#endif
+  }
+
+  T *allocate(std::size_t n) {
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+      throw std::bad_array_new_length();
+    }
+#if defined(__linux__)
+    auto const size = sizeof(T) * n;
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    if (node_ >= 0) {
+      constexpr size_t bits = 8 * sizeof(unsigned long);
+      unsigned long mask[max_nodes / bits] = {};
+      if (static_cast<size_t>(node_) >= max_nodes) {
+        munmap(p, size);
+        throw std::bad_alloc();
+      }
+      mask[node_ / bits] = 1UL << (node_ % bits);
+      // placement is a hint, unbound memory still works
+      syscall(SYS_mbind, p, size, MPOL_BIND, mask, max_nodes, 0);
+    }
+    return static_cast<T *>(p);
+#else
+    return aligned_allocator<T>().allocate(n);
+#endif
+  }
+
+  void deallocate(T *p, std::size_t n) {
+#if defined(__linux__)
+    munmap(p, sizeof(T) * n);
+#else
+    aligned_allocator<T>().deallocate(p, n);
+#endif
+  }
+
+  static constexpr size_t max_nodes = 1024;
+
+private:
+  int node_;
+};
+
+template <typename T, typename U>
+bool operator==(const numa_allocator<T> &a,
+                const numa_allocator<U> &b) noexcept {
+  return a.node() == b.node();
+}
+
+template <typename T, typename U>
+bool operator!=(const numa_allocator<T> &a,
+                const numa_allocator<U> &b) noexcept {
+  return !(a == b);
+}
+
+/// allocates memory backed by huge pages of page_size bytes (a power of two,
+/// 2M by default) to reduce tlb misses on large queues. on linux it first
+/// tries an explicit MAP_HUGETLB mapping and falls back to a regular mapping
+/// aligned to page_size and advised with MADV_HUGEPAGE when no huge pages
+/// are reserved. either way the pages are faulted in by allocate so the first
+/// lap of the queue does not take page faults. elsewhere this falls back to
+/// aligned_allocator.
+template <typename T> class huge_page_allocator {
+public:
+  using value_type = T;
+
+  explicit huge_page_allocator(const size_t page_size = size_t(1) << 21)
+      : page_size_(page_size) {
+    if (page_size_ == 0 || (page_size_ & (page_size_ - 1)) != 0) {
+      throw std::invalid_argument("page size is not a power of two");
+    }
+  }
+
+  template <typename U>
+  huge_page_allocator(const huge_page_allocator<U> &other) noexcept
+      : page_size_(other.page_size()) {}
+
+  size_t page_size() const noexcept { return page_size_; }
+
+  T *allocate(std::size_t n) {
+    if (n > (std::numeric_limits<std::size_t>::max() - page_size_) /
+                sizeof(T)) {
+      throw std::bad_array_new_length();
+    }
+#if defined(__linux__)
+    auto const size = length_(n);
+#if defined(MAP_HUGETLB)
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE;
+#if defined(MAP_HUGE_SHIFT)
+    int shift = 0;
+    while ((size_t(1) << shift) < page_size_) {
+      ++shift;
+    }
+    flags |= shift << MAP_HUGE_SHIFT;
+#endif
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p != MAP_FAILED) {
+      return static_cast<T *>(p);
+    }
+#endif
+    // map an extra page to be able to align the mapping to a huge page so
+    // that transparent huge pages can back it, then trim the excess
+    auto *base = static_cast<char *>(mmap(nullptr, size + page_size_,
+                                          PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (base == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    auto const offset =
+        (page_size_ - reinterpret_cast<uintptr_t>(base) % page_size_) %
+        page_size_;
+    auto *q = base + offset;
+    if (offset != 0) {
+      munmap(base, offset);
+    }
+    munmap(q + size, page_size_ - offset);
+#if defined(MADV_HUGEPAGE)
+    madvise(q, size, MADV_HUGEPAGE);
+#endif
+    prefault_(q, size);
+    return reinterpret_cast<T *>(q);
+#else
+    return aligned_allocator<T>().allocate(n);
+#endif
+  }
+
+  void deallocate(T *p, std::size_t n) {
+#if defined(__linux__)
+    munmap(p, length_(n));
+#else
+    aligned_allocator<T>().deallocate(p, n);
+#endif
+  }
+
+private:
+  // both kinds of mappings are rounded up to whole huge pages
+  size_t length_(const size_t n) const noexcept {
+    return (sizeof(T) * n + page_size_ - 1) & ~(page_size_ - 1);
+  }
+
+#if defined(__linux__)
+  static void prefault_(char *p, const size_t size) noexcept {
+#if defined(MADV_POPULATE_WRITE)
+    if (madvise(p, size, MADV_POPULATE_WRITE) == 0) {
+      return;
+    }
+#endif
+    // the memory is zero filled so writing a zero to every page is harmless
+    auto const page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    for (size_t i = 0; i < size; i += page) {
+      static_cast<volatile char *>(p)[i] = 0;
+    }
+  }
+#endif
+
+  size_t page_size_;
+};
+
+template <typename T, typename U>
+bool operator==(const huge_page_allocator<T> &a,
+                const huge_page_allocator<U> &b) noexcept {
+  return a.page_size() == b.page_size();
+}
+
+template <typename T, typename U>
+bool operator!=(const huge_page_allocator<T> &a,
+                const huge_page_allocator<U> &b) noexcept {
+  return !(a == b);
+}
+
+template <typename T, size_t Align = hardware_interference_size,
+          bool Trivial = std::is_trivially_copyable<T>::value>
+struct slot {
   ~slot() noexcept {
     if (turn & 1) {
       destroy();
@@ -83,188 +362,4903 @@ template <typename T> struct slot {
 
   T &&move() noexcept { return reinterpret_cast<T &&>(storage); }
 
+  T &get() noexcept { return reinterpret_cast<T &>(storage); }
+
+  void *data() noexcept { return &storage; }
+
   // align to avoid false sharing between adjacent slots
-  alignas(hardware_interference_size) std::atomic<size_t> turn = {0};
+  alignas(Align) std::atomic<ticket_type> turn = {0};
   typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
 };
 
-template <typename T, typename Allocator = aligned_allocator<slot<T>>>
-class queue {
-private:
-  static_assert(std::is_nothrow_copy_assignable<T>::value ||
-                    std::is_nothrow_move_assignable<T>::value,
-                "T must be nothrow copy or move assignable");
+// a trivially copyable T is copied in and out with memcpy and needs no
+// destruction, so the slot itself is trivially destructible and a queue of
+// them is torn down without visiting its slots
+template <typename T, size_t Align> struct slot<T, Align, true> {
+  template <typename... Args> void construct(Args &&...args) noexcept {
+    static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
+                  "T must be nothrow constructible with Args&&...");
+    new (&storage) T(std::forward<Args>(args)...);
+  }
 
-  static_assert(std::is_nothrow_destructible<T>::value,
-                "T must be nothrow destructible");
+  void construct(const T &v) noexcept { std::memcpy(&storage, &v, sizeof(T)); }
+
+  void construct(T &v) noexcept { std::memcpy(&storage, &v, sizeof(T)); }
+
+  void construct(T &&v) noexcept { std::memcpy(&storage, &v, sizeof(T)); }
+
+  void destroy() noexcept {}
+
+  T &move() noexcept { return reinterpret_cast<T &>(storage); }
+
+  T &get() noexcept { return reinterpret_cast<T &>(storage); }
+
+  void *data() noexcept { return &storage; }
+
+  // align to avoid false sharing between adjacent slots
+  alignas(Align) std::atomic<ticket_type> turn = {0};
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+};
+
+namespace detail {
+// policies are passed to queue as a pack and picked out by the tag they
+// derive from, anything that is not a policy is taken to be the allocator
+struct policy_tag {};
+struct capacity_tag : policy_tag {};
+struct layout_tag : policy_tag {};
+struct wait_tag : policy_tag {};
+struct producer_tag : policy_tag {};
+struct consumer_tag : policy_tag {};
+struct stats_tag : policy_tag {};
+struct notifier_tag : policy_tag {};
+struct overflow_tag : policy_tag {};
+struct ordering_tag : policy_tag {};
+struct storage_tag : policy_tag {};
+struct prefetch_tag : policy_tag {};
+
+template <typename Tag, typename Default, typename... Policies>
+struct find_policy {
+  using type = Default;
+};
+
+template <typename Tag, typename Default, typename P, typename... Policies>
+struct find_policy<Tag, Default, P, Policies...> {
+  using type = typename std::conditional<
+      std::is_base_of<Tag, P>::value, P,
+      typename find_policy<Tag, Default, Policies...>::type>::type;
+};
 
+template <typename Default, typename... Policies> struct find_allocator {
+  using type = Default;
+};
+
+template <typename Default, typename P, typename... Policies>
+struct find_allocator<Default, P, Policies...> {
+  using type = typename std::conditional<
+      std::is_base_of<policy_tag, P>::value,
+      typename find_allocator<Default, Policies...>::type, P>::type;
+};
+} // namespace detail
+
+/// maps tickets to slots using the capacity passed at construction, this
+/// needs a division on every operation
+class dynamic_capacity : detail::capacity_tag {
 public:
-  explicit queue(const size_t capacity,
-                 const Allocator &alloc = Allocator())
-      : capacity_(capacity), allocator_(alloc), head_(0), tail_(0) {
+  explicit dynamic_capacity(const size_t capacity) : capacity_(capacity) {
     if (capacity_ < 1) {
       throw std::invalid_argument("capacity < 1");
     }
-    // allocate one extra slot to prevent false sharing on the last slot
-    slots_ = allocator_.allocate(capacity_ + 1);
-    // allocators are not required to honor alignment for over-aligned types
-    // (see http://eel.is/c++draft/allocator.requirements#10) so we verify
-    // alignment here
-    if (reinterpret_cast<size_t>(slots_) % alignof(slot<T>) != 0) {
-      allocator_.deallocate(slots_, capacity_ + 1);
-      throw std::bad_alloc();
+  }
+
+  size_t capacity() const noexcept { return capacity_; }
+  size_t idx(ticket_type i) const noexcept {
+    return static_cast<size_t>(i % capacity_);
+  }
+  ticket_type turn(ticket_type i) const noexcept { return i / capacity_; }
+
+private:
+  size_t capacity_;
+};
+
+/// rounds the capacity passed at construction up to the next power of two so
+/// that tickets are mapped to slots with a mask and a shift
+class power_of_two_capacity : detail::capacity_tag {
+public:
+  explicit power_of_two_capacity(const size_t capacity) : shift_(0) {
+    if (capacity < 1) {
+      throw std::invalid_argument("capacity < 1");
     }
-    for (size_t i = 0; i < capacity_; ++i) {
-      new (&slots_[i]) slot<T>();
+    if (capacity > (std::numeric_limits<size_t>::max() >> 1) + 1) {
+      throw std::invalid_argument("capacity too large");
     }
-    static_assert(
-        alignof(slot<T>) == hardware_interference_size,
-        "slot must be aligned to cache line boundary to prevent false sharing");
-    static_assert(sizeof(slot<T>) % hardware_interference_size == 0,
-                  "slot size must be a multiple of cache line size to prevent "
-                  "false sharing between adjacent slots");
-    static_assert(sizeof(queue) % hardware_interference_size == 0,
-                  "queue size must be a multiple of cache line size to "
-                  "prevent false sharing between adjacent queues");
-    static_assert(
-        offsetof(queue, tail_) - offsetof(queue, head_) ==
-            static_cast<std::ptrdiff_t>(hardware_interference_size),
-        "head and tail must be a cache line apart to prevent false sharing");
+    while ((size_t(1) << shift_) < capacity) {
+      ++shift_;
+    }
+    mask_ = (size_t(1) << shift_) - 1;
   }
 
-  ~queue() noexcept {
-    for (size_t i = 0; i < capacity_; ++i) {
-      slots_[i].~slot();
-    }
-    allocator_.deallocate(slots_, capacity_ + 1);
+  size_t capacity() const noexcept { return mask_ + 1; }
+  size_t idx(ticket_type i) const noexcept {
+    return static_cast<size_t>(i & mask_);
   }
+  ticket_type turn(ticket_type i) const noexcept { return i >> shift_; }
 
-  // non-copyable and non-movable
-  queue(const queue &) = delete;
-  queue &operator=(const queue &) = delete;
+private:
+  size_t mask_;
+  unsigned shift_;
+};
 
-  template <typename... Args> void emplace(Args &&...args) noexcept {
-    static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
-                  "T must be nothrow constructible with Args&&...");
-    auto const head = head_.fetch_add(1);
-    auto &slot = slots_[idx_(head)];
-    while (turn_(head) * 2 != slot.turn.load(std::memory_order_acquire))
-      ;
-    slot.construct(std::forward<Args>(args)...);
-    slot.turn.store(turn_(head) * 2 + 1, std::memory_order_release);
-  }
+/// fixes the capacity at compile time so that the index math folds to
+/// constants, a power of two N gives a mask and a shift
+template <size_t N> class static_capacity : detail::capacity_tag {
+  static_assert(N >= 1, "capacity < 1");
 
-  template <typename... Args> bool try_emplace(Args &&...args) noexcept {
-    static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
-                  "T must be nothrow constructible with Args&&...");
-    auto head = head_.load(std::memory_order_acquire);
-    for (;;) {
-      auto &slot = slots_[idx_(head)];
-      if (turn_(head) * 2 == slot.turn.load(std::memory_order_acquire)) {
-        if (head_.compare_exchange_strong(head, head + 1)) {
-          slot.construct(std::forward<Args>(args)...);
-          slot.turn.store(turn_(head) * 2 + 1, std::memory_order_release);
-          return true;
-        }
-      } else {
-        auto const prev_head = head;
-        head = head_.load(std::memory_order_acquire);
-        if (head == prev_head) {
-          return false;
-        }
-      }
+public:
+  static_capacity() = default;
+
+  explicit static_capacity(const size_t capacity) {
+    if (capacity != N) {
+      throw std::invalid_argument("capacity != N");
     }
   }
 
-  void push(const T &v) noexcept {
-    static_assert(std::is_nothrow_copy_constructible<T>::value,
-                  "T must be nothrow copy constructible");
-    emplace(v);
+  constexpr size_t capacity() const noexcept { return N; }
+  constexpr size_t idx(ticket_type i) const noexcept {
+    return static_cast<size_t>(i % N);
   }
+  constexpr ticket_type turn(ticket_type i) const noexcept { return i / N; }
+};
 
-  template <typename P,
-            typename = typename std::enable_if<
-                std::is_nothrow_constructible<T, P &&>::value>::type>
-  void push(P &&v) noexcept {
-    emplace(std::forward<P>(v));
-  }
+namespace detail {
+constexpr size_t next_pow2(size_t n, size_t p = 1) noexcept {
+  return p >= n ? p : next_pow2(n, p * 2);
+}
 
-  bool try_push(const T &v) noexcept {
-    static_assert(std::is_nothrow_copy_constructible<T>::value,
-                  "T must be nothrow copy constructible");
-    return try_emplace(v);
-  }
+// alignment of a compact slot, its natural size rounded up to a power of two
+// so that a whole number of slots fits in a cache line
+template <typename T> struct compact_align {
+  using natural = slot<T, alignof(std::atomic<ticket_type>)>;
+  static constexpr size_t value =
+      sizeof(natural) > hardware_interference_size
+          ? alignof(natural)
+          : next_pow2(sizeof(natural));
+};
+} // namespace detail
 
-  template <typename P,
-            typename = typename std::enable_if<
-                std::is_nothrow_constructible<T, P &&>::value>::type>
-  bool try_push(P &&v) noexcept {
-    return try_emplace(std::forward<P>(v));
-  }
+/// pads every slot to a whole cache line so that adjacent slots never share
+/// one, this is the fastest layout when memory is not a concern
+struct padded_slots : detail::layout_tag {
+  static constexpr bool padded = true;
 
-  void pop(T &v) noexcept {
-    auto const tail = tail_.fetch_add(1);
-    auto &slot = slots_[idx_(tail)];
-    while (turn_(tail) * 2 + 1 != slot.turn.load(std::memory_order_acquire))
-      ;
-    v = slot.move();
-    slot.destroy();
-    slot.turn.store(turn_(tail) * 2 + 2, std::memory_order_release);
-  }
+  template <typename T> using slot_type = slot<T>;
 
-  bool try_pop(T &v) noexcept {
-    auto tail = tail_.load(std::memory_order_acquire);
-    for (;;) {
-      auto &slot = slots_[idx_(tail)];
-      if (turn_(tail) * 2 + 1 == slot.turn.load(std::memory_order_acquire)) {
-        if (tail_.compare_exchange_strong(tail, tail + 1)) {
-          v = slot.move();
-          slot.destroy();
-          slot.turn.store(turn_(tail) * 2 + 2, std::memory_order_release);
-          return true;
-        }
-      } else {
-        auto const prev_tail = tail;
-        tail = tail_.load(std::memory_order_acquire);
-        if (tail == prev_tail) {
-          return false;
-        }
-      }
-    }
-  }
+  template <typename T> class mapping {
+  public:
+    explicit mapping(const size_t) noexcept {}
+    size_t operator()(size_t i) const noexcept { return i; }
+  };
+};
 
-  /// returns the number of elements in the queue.
-  /// the size can be negative when the queue is empty and there is at least one
-  /// reader waiting. since this is a concurrent queue the size is only a best
-  /// effort guess until all reader and writer threads have been joined.
-  ptrdiff_t size() const noexcept {
-    // todo: how can we deal with wrapped queue on 32bit?
-    return static_cast<ptrdiff_t>(head_.load(std::memory_order_relaxed) -
-                                  tail_.load(std::memory_order_relaxed));
-  }
+/// packs slots tightly, rounding their size up to a power of two, and remaps
+/// slot indices so that consecutive tickets land on different cache lines. a
+/// slot for an 8 byte T takes 16 bytes instead of a cache line. the remapping
+/// needs the capacity to be a multiple of the number of slots per cache line
+/// and is skipped otherwise
+struct compact_slots : detail::layout_tag {
+  static constexpr bool padded = false;
 
-  /// returns true if the queue is empty.
-  /// since this is a concurrent queue this is only a best effort guess
-  /// until all reader and writer threads have been joined.
-  bool empty() const noexcept { return size() <= 0; }
+  template <typename T>
+  using slot_type = slot<T, detail::compact_align<T>::value>;
 
-private:
-  constexpr size_t idx_(size_t i) const noexcept { return i % capacity_; }
+  template <typename T> class mapping {
+    static constexpr size_t per_line =
+        sizeof(slot_type<T>) < hardware_interference_size
+            ? hardware_interference_size / sizeof(slot_type<T>)
+            : 1;
 
-  constexpr size_t turn_(size_t i) const noexcept { return i / capacity_; }
+  public:
+    explicit mapping(const size_t capacity) noexcept
+        : lines_(capacity % per_line == 0 ? capacity / per_line : 0) {}
 
-private:
-  const size_t capacity_;
-  slot<T> *slots_;
-#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
-  Allocator allocator_ [[no_unique_address]];
-#else
-  Allocator allocator_;
-#endif
+    // slot i * per_line + j is stored at j * lines + i
+    size_t operator()(size_t i) const noexcept {
+      return lines_ != 0 ? (i % per_line) * lines_ + i / per_line : i;
+    }
 
-  // align to avoid false sharing between head_ and tail_
-  alignas(hardware_interference_size) std::atomic<size_t> head_;
-  alignas(hardware_interference_size) std::atomic<size_t> tail_;
+  private:
+    size_t lines_;
+  };
+};
+
+namespace detail {
+template <typename Capacity> struct static_size {
+  static constexpr bool value = false;
+};
+
+template <size_t N> struct static_size<static_capacity<N>> {
+  static constexpr bool value = true;
+  static constexpr size_t size = N;
 };
+} // namespace detail
+
+/// gets the slots from the allocator at construction, one extra slot
+/// prevents false sharing on the last one
+struct heap_storage : detail::storage_tag {
+  template <typename Slot, typename Capacity> class storage {
+  public:
+    template <typename Allocator>
+    void allocate(Allocator &alloc, const size_t capacity) {
+      slots_ = alloc.allocate(capacity + 1);
+      // allocators are not required to honor alignment for over-aligned
+      // types (see http://eel.is/c++draft/allocator.requirements#10) so we
+      // verify alignment here
+      if (reinterpret_cast<size_t>(slots_) % alignof(Slot) != 0) {
+        alloc.deallocate(slots_, capacity + 1);
+        throw std::bad_alloc();
+      }
+    }
+
+    template <typename Allocator>
+    void deallocate(Allocator &alloc, const size_t capacity) noexcept {
+      alloc.deallocate(slots_, capacity + 1);
+    }
+
+    Slot &operator[](size_t i) noexcept { return slots_[i]; }
+    const Slot &operator[](size_t i) const noexcept { return slots_[i]; }
+
+  private:
+    Slot *slots_;
+  };
+};
+
+/// embeds the slots in the queue itself so that it never touches the
+/// allocator and can live in static storage or inside another structure.
+/// needs static_capacity<N>, the slots are padded to whole cache lines
+/// so that the last one does not share a line with the members after it
+struct inline_storage : detail::storage_tag {
+  template <typename Slot, typename Capacity> class storage {
+    static_assert(detail::static_size<Capacity>::value,
+                  "inline_storage needs static_capacity<N>");
+
+    static constexpr size_t bytes =
+        (sizeof(Slot) * detail::static_size<Capacity>::size +
+         hardware_interference_size - 1) /
+        hardware_interference_size * hardware_interference_size;
+    static constexpr size_t align = alignof(Slot) > hardware_interference_size
+                                        ? alignof(Slot)
+                                        : hardware_interference_size;
+
+  public:
+    template <typename Allocator> void allocate(Allocator &, const size_t) {}
+
+    template <typename Allocator>
+    void deallocate(Allocator &, const size_t) noexcept {}
+
+    Slot &operator[](size_t i) noexcept {
+      return reinterpret_cast<Slot *>(data_)[i];
+    }
+    const Slot &operator[](size_t i) const noexcept {
+      return reinterpret_cast<const Slot *>(data_)[i];
+    }
+
+  private:
+    alignas(align) unsigned char data_[bytes];
+  };
+};
+
+namespace detail {
+// deadline of an untimed wait
+struct no_deadline {};
+
+constexpr bool expired(const no_deadline &) noexcept { return false; }
+
+template <typename Clock, typename Duration>
+bool expired(const std::chrono::time_point<Clock, Duration> &deadline) noexcept {
+  return Clock::now() >= deadline;
+}
+
+// asks for the cache lines of [p, p + bytes) ahead of use, with write
+// intent where the compiler can express it
+template <bool Write>
+inline void prefetch(const void *p, const size_t bytes) noexcept {
+  auto const c = static_cast<const char *>(p);
+  for (size_t i = 0; i < bytes; i += hardware_interference_size) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(c + i, Write ? 1 : 0, 3);
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+    _mm_prefetch(c + i, _MM_HINT_T0);
+#else
+    (void)c;
+#endif
+  }
+}
+
+// hint to the cpu that we are in a spin loop
+inline void cpu_relax() noexcept {
+#if defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// threads park on a bucket picked by the address they wait on. the epoch is
+// bumped on every wake so a parked thread can detect that it missed a wake
+// between deciding to park and parking. waiters counts the parked threads so
+// that notify only makes a system call when there is someone to wake
+struct alignas(hardware_interference_size) parking_bucket {
+  std::atomic<uint32_t> epoch = {0};
+  std::atomic<uint32_t> waiters = {0};
+#if !defined(__linux__)
+  std::mutex mutex;
+  std::condition_variable cv;
+#endif
+};
+
+class parking_lot {
+public:
+  static parking_bucket &bucket(const void *addr) noexcept {
+    auto const h =
+        reinterpret_cast<uintptr_t>(addr) / hardware_interference_size;
+    return buckets()[(h ^ (h / bucket_count)) % bucket_count];
+  }
+
+  // parks the calling thread while the epoch of the bucket equals epoch
+  static void park(parking_bucket &b, const uint32_t epoch,
+                   const no_deadline &) noexcept {
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&b.epoch),
+            FUTEX_WAIT_PRIVATE, epoch, nullptr, nullptr, 0);
+#else
+    std::unique_lock<std::mutex> lock(b.mutex);
+    while (b.epoch.load(std::memory_order_relaxed) == epoch) {
+      b.cv.wait(lock);
+    }
+#endif
+  }
+
+  // parks the calling thread while the epoch of the bucket equals epoch and
+  // the deadline has not passed
+  template <typename Clock, typename Duration>
+  static void
+  park(parking_bucket &b, const uint32_t epoch,
+       const std::chrono::time_point<Clock, Duration> &deadline) noexcept {
+#if defined(__linux__)
+    auto const now = Clock::now();
+    if (now >= deadline) {
+      return;
+    }
+    auto const timeout =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now)
+            .count();
+    timespec ts;
+    ts.tv_sec = static_cast<time_t>(timeout / 1000000000);
+    ts.tv_nsec = static_cast<long>(timeout % 1000000000);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&b.epoch),
+            FUTEX_WAIT_PRIVATE, epoch, &ts, nullptr, 0);
+#else
+    std::unique_lock<std::mutex> lock(b.mutex);
+    while (b.epoch.load(std::memory_order_relaxed) == epoch) {
+      if (b.cv.wait_until(lock, deadline) == std::cv_status::timeout) {
+        return;
+      }
+    }
+#endif
+  }
+
+  static void unpark_all(parking_bucket &b) noexcept {
+#if defined(__linux__)
+    b.epoch.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&b.epoch),
+            FUTEX_WAKE_PRIVATE, std::numeric_limits<int>::max(), nullptr,
+            nullptr, 0);
+#else
+    {
+      std::lock_guard<std::mutex> lock(b.mutex);
+      b.epoch.fetch_add(1, std::memory_order_release);
+    }
+    b.cv.notify_all();
+#endif
+  }
+
+  // wakes the threads parked on every bucket, whatever they wait on
+  static void unpark_every() noexcept {
+    for (size_t i = 0; i < bucket_count; ++i) {
+      unpark_all(buckets()[i]);
+    }
+  }
+
+private:
+  static parking_bucket *buckets() noexcept {
+    static parking_bucket buckets[bucket_count];
+    return buckets;
+  }
+
+  static constexpr size_t bucket_count = 64;
+};
+} // namespace detail
+
+/// wait strategies decide what a blocking operation does while waiting for
+/// the turn of its slot. wait(word, ready) returns once ready() is true,
+/// wait_until(word, ready, deadline) also returns false once the deadline
+/// has passed, and notify(word) is called after every change of word.
+/// notify_all() wakes every waiting thread so it re-evaluates ready, it is
+/// called when a queue is closed.
+
+/// spins on the turn without pausing, gives the lowest latency but keeps
+/// the core busy while waiting
+struct spin_wait : detail::wait_tag {
+  template <typename Ready>
+  static void wait(const std::atomic<ticket_type> &word,
+                   Ready &&ready) noexcept {
+    wait_until(word, ready, detail::no_deadline());
+  }
+
+  template <typename Ready, typename Deadline>
+  static bool wait_until(const std::atomic<ticket_type> &, Ready &&ready,
+                         const Deadline &deadline) noexcept {
+    while (!ready()) {
+      if (detail::expired(deadline)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static void notify(const std::atomic<ticket_type> &) noexcept {}
+
+  static void notify_all() noexcept {}
+};
+
+/// spins with a pause instruction and then yields the core, never parks
+struct backoff_wait : detail::wait_tag {
+  template <typename Ready>
+  static void wait(const std::atomic<ticket_type> &word,
+                   Ready &&ready) noexcept {
+    wait_until(word, ready, detail::no_deadline());
+  }
+
+  template <typename Ready, typename Deadline>
+  static bool wait_until(const std::atomic<ticket_type> &, Ready &&ready,
+                         const Deadline &deadline) noexcept {
+    for (size_t i = 0; !ready(); ++i) {
+      if (detail::expired(deadline)) {
+        return false;
+      }
+      if (i < spin_limit) {
+        detail::cpu_relax();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    return true;
+  }
+
+  static void notify(const std::atomic<ticket_type> &) noexcept {}
+
+  static void notify_all() noexcept {}
+
+  static constexpr size_t spin_limit = 128;
+};
+
+/// spins, yields and finally parks the thread in the kernel (futex on linux,
+/// a condition variable elsewhere) until the turn changes. notify costs a
+/// fence and a load when no thread is parked, and a system call otherwise
+struct park_wait : detail::wait_tag {
+  template <typename Ready>
+  static void wait(const std::atomic<ticket_type> &word,
+                   Ready &&ready) noexcept {
+    wait_until(word, ready, detail::no_deadline());
+  }
+
+  template <typename Ready, typename Deadline>
+  static bool wait_until(const std::atomic<ticket_type> &word, Ready &&ready,
+                         const Deadline &deadline) noexcept {
+    for (size_t i = 0; i < spin_limit + yield_limit; ++i) {
+      if (ready()) {
+        return true;
+      }
+      if (detail::expired(deadline)) {
+        return false;
+      }
+      if (i < spin_limit) {
+        detail::cpu_relax();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    auto &b = detail::parking_lot::bucket(&word);
+    for (;;) {
+      auto const epoch = b.epoch.load(std::memory_order_acquire);
+      b.waiters.fetch_add(1, std::memory_order_acq_rel);
+      // pairs with the fence in notify, either notify sees the waiter or the
+      // waiter sees the new turn
+#if !defined(MPMC_THREAD_SANITIZER)
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+      if (ready()) {
+        b.waiters.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+      detail::parking_lot::park(b, epoch, deadline);
+      b.waiters.fetch_sub(1, std::memory_order_relaxed);
+      if (ready()) {
+        return true;
+      }
+      if (detail::expired(deadline)) {
+        return false;
+      }
+    }
+  }
+
+  static void notify(const std::atomic<ticket_type> &word) noexcept {
+    auto &b = detail::parking_lot::bucket(&word);
+#if defined(MPMC_THREAD_SANITIZER)
+    if (b.waiters.fetch_add(0, std::memory_order_acq_rel) != 0) {
+#else
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (b.waiters.load(std::memory_order_relaxed) != 0) {
+#endif
+      detail::parking_lot::unpark_all(b);
+    }
+  }
+
+  static void notify_all() noexcept {
+    // pairs with the fence in wait like notify, but wakes every bucket
+    // unconditionally since the waiters may park on any of them
+#if !defined(MPMC_THREAD_SANITIZER)
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+    detail::parking_lot::unpark_every();
+  }
+
+  static constexpr size_t spin_limit = 128;
+  static constexpr size_t yield_limit = 16;
+};
+
+#if defined(MPMC_HAS_COROUTINES)
+namespace detail {
+// a suspended coroutine registered on a bucket of the async lot. it waits
+// for the word at addr to take the value key, a slot turn. ready tells
+// whether the operation it waits for can complete and resume schedules the
+// coroutine, both are set by the awaitable embedding it so registering
+// allocates nothing
+struct async_waiter {
+  bool (*ready)(async_waiter *) noexcept;
+  void (*resume)(async_waiter *) noexcept;
+  async_waiter *next;
+  const void *addr;
+  ticket_type key;
+};
+
+struct alignas(hardware_interference_size) async_bucket {
+  std::atomic<uint32_t> waiters = {0};
+  std::mutex mutex;
+  async_waiter *head = nullptr;
+};
+
+// coroutines wait on a bucket picked by the address and the value they wait
+// for. a notifier only takes the lock of the bucket of the value it stored
+// and only resumes the waiters for that value, so it never walks waiters
+// parked on other slots or on later turns of its slot
+class async_lot {
+public:
+  static async_bucket &bucket(const void *addr, const ticket_type key) noexcept {
+    auto const h =
+        static_cast<uint64_t>(reinterpret_cast<uintptr_t>(addr) /
+                              hardware_interference_size) ^
+        key * 0x9e3779b97f4a7c15ull;
+    return buckets()[static_cast<size_t>(h ^ (h >> 32)) % bucket_count];
+  }
+
+  // registers w unless it became ready, returns false if it did and the
+  // coroutine must not suspend. the check is made under the lock since once
+  // it is released a notifier may resume the coroutine and w is gone
+  static bool park(async_waiter &w) noexcept {
+    auto &b = bucket(w.addr, w.key);
+    std::lock_guard<std::mutex> lock(b.mutex);
+    w.next = b.head;
+    b.head = &w;
+    b.waiters.fetch_add(1, std::memory_order_relaxed);
+    // pairs with the fence in notify, either notify sees the waiter or the
+    // waiter sees the new turn
+#if defined(MPMC_THREAD_SANITIZER)
+    b.waiters.fetch_add(0, std::memory_order_seq_cst);
+#else
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+    if (w.ready(&w)) {
+      unlink_(b, w);
+      return false;
+    }
+    return true;
+  }
+
+  // resumes the waiters for the value key of the word at addr, outside the
+  // lock since a resumed coroutine may wait again
+  static void unpark(async_bucket &b, const void *addr,
+                     const ticket_type key) noexcept {
+    resume_(take_(b, [addr, key](async_waiter *w) noexcept {
+      return w->addr == addr && w->key == key && w->ready(w);
+    }));
+  }
+
+  // resumes every waiter that is ready, used on close when waiters for
+  // turns that never come become ready
+  static void unpark_every() noexcept {
+    for (size_t i = 0; i < bucket_count; ++i) {
+      resume_(take_(buckets()[i],
+                    [](async_waiter *w) noexcept { return w->ready(w); }));
+    }
+  }
+
+  // unregisters w if it is still parked
+  static void cancel(async_waiter &w) noexcept {
+    auto &b = bucket(w.addr, w.key);
+    std::lock_guard<std::mutex> lock(b.mutex);
+    for (auto *p = b.head; p != nullptr; p = p->next) {
+      if (p == &w) {
+        unlink_(b, w);
+        break;
+      }
+    }
+  }
+
+private:
+  // unlinks the waiters of b matching f and returns them as a list
+  template <typename F>
+  static async_waiter *take_(async_bucket &b, F &&f) noexcept {
+    async_waiter *taken = nullptr;
+    std::lock_guard<std::mutex> lock(b.mutex);
+    for (auto **p = &b.head; *p != nullptr;) {
+      auto *const w = *p;
+      if (f(w)) {
+        *p = w->next;
+        b.waiters.fetch_sub(1, std::memory_order_relaxed);
+        w->next = taken;
+        taken = w;
+      } else {
+        p = &w->next;
+      }
+    }
+    return taken;
+  }
+
+  static void resume_(async_waiter *w) noexcept {
+    while (w != nullptr) {
+      auto *const next = w->next;
+      w->resume(w);
+      w = next;
+    }
+  }
+
+  static void unlink_(async_bucket &b, async_waiter &w) noexcept {
+    for (auto **p = &b.head; *p != nullptr; p = &(*p)->next) {
+      if (*p == &w) {
+        *p = w.next;
+        break;
+      }
+    }
+    b.waiters.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  static async_bucket *buckets() noexcept {
+    static async_bucket buckets[bucket_count];
+    return buckets;
+  }
+
+  static constexpr size_t bucket_count = 256;
+};
+} // namespace detail
+
+/// resumes a coroutine on the thread that completed the operation it
+/// waited for
+struct inline_executor {
+  void operator()(std::coroutine_handle<> h) const { h.resume(); }
+};
+
+/// waits like park_wait and also resumes coroutines suspended in
+/// async_push and async_pop. notify costs one fence and three loads when
+/// nobody waits. the word only moves on once the coroutine waiting for its
+/// value has run, so the value loaded after the fence is the one a parked
+/// coroutine can be waiting for
+struct coroutine_wait : park_wait {
+  static void notify(const std::atomic<ticket_type> &word) noexcept {
+    auto &b = detail::parking_lot::bucket(&word);
+#if defined(MPMC_THREAD_SANITIZER)
+    if (b.waiters.fetch_add(0, std::memory_order_acq_rel) != 0) {
+      detail::parking_lot::unpark_all(b);
+    }
+    auto const key = word.load(std::memory_order_acquire);
+    auto &a = detail::async_lot::bucket(&word, key);
+    if (a.waiters.fetch_add(0, std::memory_order_acq_rel) != 0) {
+      detail::async_lot::unpark(a, &word, key);
+    }
+#else
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (b.waiters.load(std::memory_order_relaxed) != 0) {
+      detail::parking_lot::unpark_all(b);
+    }
+    auto const key = word.load(std::memory_order_relaxed);
+    auto &a = detail::async_lot::bucket(&word, key);
+    if (a.waiters.load(std::memory_order_relaxed) != 0) {
+      detail::async_lot::unpark(a, &word, key);
+    }
+#endif
+  }
+
+  static void notify_all() noexcept {
+    park_wait::notify_all();
+    detail::async_lot::unpark_every();
+  }
+};
+#endif
+
+namespace detail {
+// claims tickets from an index shared by many threads with atomic
+// read-modify-write operations
+struct shared_index {
+  static ticket_type claim(std::atomic<ticket_type> &index, const size_t n,
+                           const std::memory_order order) noexcept {
+    return index.fetch_add(n, order);
+  }
+
+  static bool try_claim(std::atomic<ticket_type> &index, ticket_type &expected,
+                        const size_t n,
+                        const std::memory_order order) noexcept {
+    return index.compare_exchange_strong(expected, expected + n, order);
+  }
+};
+
+// claims tickets from an index owned by a single thread with a plain load and
+// store, the slot turns still synchronize with the other side
+struct exclusive_index {
+  static ticket_type claim(std::atomic<ticket_type> &index, const size_t n,
+                           const std::memory_order) noexcept {
+    auto const i = index.load(std::memory_order_relaxed);
+    index.store(i + n, std::memory_order_relaxed);
+    return i;
+  }
+
+  static bool try_claim(std::atomic<ticket_type> &index, ticket_type &expected,
+                        const size_t n, const std::memory_order) noexcept {
+    index.store(expected + n, std::memory_order_relaxed);
+    return true;
+  }
+};
+} // namespace detail
+
+/// cardinality policies declare how many threads push and pop concurrently.
+/// the multi side claims tickets with fetch_add and compare and swap, the
+/// single side with a plain load and store. using a single policy while
+/// several threads operate on that side is undefined behavior.
+struct multi_producer : detail::producer_tag, detail::shared_index {};
+struct single_producer : detail::producer_tag, detail::exclusive_index {};
+struct multi_consumer : detail::consumer_tag, detail::shared_index {};
+struct single_consumer : detail::consumer_tag, detail::exclusive_index {};
+
+/// ordering policies pick the memory order of the operations on the head and
+/// tail. the element is handed over by the release store and acquire load of
+/// the turn of its slot, so claiming a ticket only needs to be atomic.
+
+/// claims tickets with sequentially consistent read-modify-write operations
+/// and acquire loads, the historical behavior
+struct seq_cst_ordering : detail::ordering_tag {
+  static constexpr std::memory_order rmw = std::memory_order_seq_cst;
+  static constexpr std::memory_order load = std::memory_order_acquire;
+};
+
+/// claims tickets with relaxed operations. this removes the barriers around
+/// every claim on weakly ordered hardware such as arm, on x86 the generated
+/// code is the same since every read-modify-write is a full barrier there.
+/// operations on other queues or variables are no longer ordered with the
+/// claim, only with the turn of the slot.
+struct relaxed_ordering : detail::ordering_tag {
+  static constexpr std::memory_order rmw = std::memory_order_relaxed;
+  static constexpr std::memory_order load = std::memory_order_relaxed;
+};
+
+/// overflow policies decide what a producer does when its slot still holds
+/// an unread item.
+
+/// blocking operations wait for a consumer and try operations fail
+struct block_when_full : detail::overflow_tag {
+  static constexpr bool overwrite = false;
+};
+
+/// producers never wait for consumers. a producer that finds the queue full
+/// claims the oldest ticket from the tail like a consumer would, destroys
+/// its item and counts the drop, so the queue keeps the newest items. the
+/// tail is shared with producers, so the consumers must be multi_consumer.
+/// consumers see dropped items as gaps in the sequence numbers returned by
+/// pop(v, seq) and try_pop(v, seq).
+struct overwrite_oldest : detail::overflow_tag {
+  static constexpr bool overwrite = true;
+};
+
+/// prefetch policies decide whether an operation warms up the slot of a
+/// ticket a few steps ahead of the one it has claimed.
+
+/// no prefetching
+struct no_prefetch : detail::prefetch_tag {
+  static constexpr bool enabled = false;
+  static constexpr ticket_type distance = 0;
+};
+
+/// after claiming ticket t a producer prefetches the slot of t + Distance
+/// for writing and a consumer prefetches it for reading, every cache line
+/// of the slot is requested. no latency gain has been measured yet, see the
+/// benchmark section of the readme before enabling it
+template <size_t Distance = 2>
+struct prefetch_ahead : detail::prefetch_tag {
+  static_assert(Distance >= 1, "Distance < 1");
+  static constexpr bool enabled = true;
+  static constexpr ticket_type distance = Distance;
+};
+
+/// a snapshot of the counters of a queue, all zero without a stats policy
+struct queue_stats {
+  /// compare and swap operations that lost a race and were retried
+  uint64_t cas_retries = 0;
+  /// checks of a slot turn that failed in blocking operations
+  uint64_t spin_iterations = 0;
+  /// try operations that failed because the queue was full
+  uint64_t full = 0;
+  /// try operations that failed because the queue was empty
+  uint64_t empty = 0;
+  /// highest number of elements seen in the queue by a producer
+  uint64_t high_water_mark = 0;
+};
+
+/// stats policies decide whether a queue counts events on its hot paths.
+
+/// counts nothing, every hook compiles away
+struct no_stats : detail::stats_tag {
+  static constexpr bool enabled = false;
+
+  void cas_retry() noexcept {}
+  void spin() noexcept {}
+  void full() noexcept {}
+  void empty() noexcept {}
+  void occupancy(ptrdiff_t) noexcept {}
+  void sample_head(ticket_type, size_t) noexcept {}
+  void sample_tail(ticket_type, size_t) noexcept {}
+  ticket_type head_sample() const noexcept { return 0; }
+  ticket_type tail_sample() const noexcept { return 0; }
+  queue_stats snapshot() const noexcept { return queue_stats(); }
+};
+
+namespace detail {
+// shard of the calling thread, threads are assigned shards round robin
+inline size_t thread_shard() noexcept {
+  static std::atomic<size_t> next(0);
+  static thread_local size_t shard =
+      next.fetch_add(1, std::memory_order_relaxed);
+  return shard;
+}
+
+static constexpr size_t no_cpu = std::numeric_limits<size_t>::max();
+
+// cpu the calling thread first ran on, or no_cpu where the cpu cannot be
+// queried. cached since threads that care are pinned
+inline size_t thread_cpu() noexcept {
+  static thread_local size_t cpu = []() -> size_t {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned c = 0, n = 0;
+    if (syscall(SYS_getcpu, &c, &n, nullptr) == 0) {
+      return c;
+    }
+#endif
+    return no_cpu;
+  }();
+  return cpu;
+}
+} // namespace detail
+
+/// counts events in cache line padded shards picked by the calling thread
+/// so that counting does not add contention between threads. counters are
+/// relaxed and a snapshot sums the shards, it is exact once all threads
+/// operating on the queue have been joined. tracking the high water mark
+/// costs producers a load of the tail. it also keeps the copies of the head
+/// and tail read by approx_size, each on a line of its own, which are only
+/// raised so the estimate never moves back to an older ticket.
+struct sharded_stats : detail::stats_tag {
+  static constexpr bool enabled = true;
+
+  void cas_retry() noexcept { add(&shard::cas_retries); }
+  void spin() noexcept { add(&shard::spin_iterations); }
+  void full() noexcept { add(&shard::full); }
+  void empty() noexcept { add(&shard::empty); }
+
+  void occupancy(const ptrdiff_t n) noexcept {
+    if (n <= 0) {
+      return;
+    }
+    auto &hwm = local().high_water_mark;
+    auto cur = hwm.load(std::memory_order_relaxed);
+    while (static_cast<uint64_t>(n) > cur &&
+           !hwm.compare_exchange_weak(cur, static_cast<uint64_t>(n),
+                                      std::memory_order_relaxed)) {
+    }
+  }
+
+  // raises the copy of the head or tail to ticket + 1 when ticket is the
+  // first of a sample interval, a delayed thread never lowers it
+  void sample_head(const ticket_type ticket, const size_t mask) noexcept {
+    sample(head_sample_, ticket, mask);
+  }
+  void sample_tail(const ticket_type ticket, const size_t mask) noexcept {
+    sample(tail_sample_, ticket, mask);
+  }
+  ticket_type head_sample() const noexcept {
+    return head_sample_.load(std::memory_order_relaxed);
+  }
+  ticket_type tail_sample() const noexcept {
+    return tail_sample_.load(std::memory_order_relaxed);
+  }
+
+  queue_stats snapshot() const noexcept {
+    queue_stats s;
+    for (auto &sh : shards_) {
+      s.cas_retries += sh.cas_retries.load(std::memory_order_relaxed);
+      s.spin_iterations += sh.spin_iterations.load(std::memory_order_relaxed);
+      s.full += sh.full.load(std::memory_order_relaxed);
+      s.empty += sh.empty.load(std::memory_order_relaxed);
+      auto const hwm = sh.high_water_mark.load(std::memory_order_relaxed);
+      s.high_water_mark = hwm > s.high_water_mark ? hwm : s.high_water_mark;
+    }
+    return s;
+  }
+
+  static constexpr size_t shard_count = 16;
+
+private:
+  struct alignas(hardware_interference_size) shard {
+    std::atomic<uint64_t> cas_retries = {0};
+    std::atomic<uint64_t> spin_iterations = {0};
+    std::atomic<uint64_t> full = {0};
+    std::atomic<uint64_t> empty = {0};
+    std::atomic<uint64_t> high_water_mark = {0};
+  };
+
+  shard &local() noexcept {
+    return shards_[detail::thread_shard() % shard_count];
+  }
+
+  void add(std::atomic<uint64_t> shard::*counter) noexcept {
+    (local().*counter).fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static void sample(std::atomic<ticket_type> &copy, const ticket_type ticket,
+                     const size_t mask) noexcept {
+    if ((ticket & mask) != 0) {
+      return;
+    }
+    auto cur = copy.load(std::memory_order_relaxed);
+    while (ticket + 1 > cur &&
+           !copy.compare_exchange_weak(cur, ticket + 1,
+                                       std::memory_order_relaxed)) {
+    }
+  }
+
+  shard shards_[shard_count];
+  alignas(hardware_interference_size) std::atomic<ticket_type> head_sample_ =
+      {0};
+  alignas(hardware_interference_size) std::atomic<ticket_type> tail_sample_ =
+      {0};
+};
+
+/// notifier policies signal a pollable handle when an item is published to
+/// a queue whose consumer is waiting in an event loop. without one, the
+/// default no_notifier, publishing costs nothing extra.
+struct no_notifier : detail::notifier_tag {
+  static constexpr bool enabled = false;
+
+  void notify() noexcept {}
+  int native_handle() const noexcept { return -1; }
+  void arm() noexcept {}
+  void disarm() noexcept {}
+  void acknowledge() noexcept {}
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+/// signals an eventfd on linux and a pipe elsewhere. the consumer arms the
+/// notifier before it polls native_handle and the first publish after that
+/// disarms it and makes the handle readable, so publishes are coalesced and
+/// producers only make a system call when the consumer is armed. otherwise
+/// notify costs producers a fence and a load, like park_wait.
+class fd_notifier : detail::notifier_tag {
+public:
+  static constexpr bool enabled = true;
+
+  fd_notifier() {
+#if defined(__linux__)
+    fds_[0] = fds_[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds_[0] == -1) {
+      throw std::system_error(errno, std::system_category(), "eventfd");
+    }
+#else
+    if (pipe(fds_) == -1) {
+      throw std::system_error(errno, std::system_category(), "pipe");
+    }
+    for (auto fd : fds_) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+  }
+
+  ~fd_notifier() noexcept {
+    close(fds_[0]);
+    if (fds_[1] != fds_[0]) {
+      close(fds_[1]);
+    }
+  }
+
+  // non-copyable and non-movable
+  fd_notifier(const fd_notifier &) = delete;
+  fd_notifier &operator=(const fd_notifier &) = delete;
+
+  // called by producers after every publish
+  void notify() noexcept {
+    // pairs with the fence in arm, either the producer sees the armed
+    // consumer or the consumer sees the published item
+#if defined(MPMC_THREAD_SANITIZER)
+    if (armed_.fetch_add(0, std::memory_order_seq_cst) != 0 &&
+#else
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (armed_.load(std::memory_order_relaxed) != 0 &&
+#endif
+        armed_.exchange(0, std::memory_order_acq_rel) != 0) {
+      signal_();
+    }
+  }
+
+  int native_handle() const noexcept { return fds_[0]; }
+
+  void arm() noexcept {
+#if defined(MPMC_THREAD_SANITIZER)
+    armed_.exchange(1, std::memory_order_seq_cst);
+#else
+    armed_.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+  }
+
+  void disarm() noexcept { armed_.store(0, std::memory_order_relaxed); }
+
+  // consumes the readiness of the handle
+  void acknowledge() noexcept {
+    uint64_t buf[8];
+    while (read(fds_[0], buf, sizeof(buf)) > 0) {
+    }
+  }
+
+private:
+  void signal_() noexcept {
+    // a full eventfd or pipe is already readable, the signal is coalesced
+#if defined(__linux__)
+    uint64_t const one = 1;
+    if (write(fds_[1], &one, sizeof(one)) < 0) {
+    }
+#else
+    char const one = 1;
+    if (write(fds_[1], &one, sizeof(one)) < 0) {
+    }
+#endif
+  }
+
+  int fds_[2];
+  std::atomic<uint32_t> armed_ = {0};
+};
+#endif
+
+/// queue<T, Policies...>
+/// the policy pack may contain at most one policy of each kind and optionally
+/// an allocator, policies that are not given take their default:
+/// - capacity: dynamic_capacity, power_of_two_capacity or static_capacity<N>
+/// - layout: padded_slots or compact_slots
+/// - wait: spin_wait, backoff_wait, park_wait or coroutine_wait
+/// - producer: multi_producer or single_producer
+/// - consumer: multi_consumer or single_consumer
+/// - stats: no_stats or sharded_stats
+/// - ordering: seq_cst_ordering or relaxed_ordering
+/// - notifier: no_notifier or fd_notifier
+/// - overflow: block_when_full or overwrite_oldest
+/// - storage: heap_storage or inline_storage
+/// - prefetch: no_prefetch or prefetch_ahead<Distance>
+/// - allocator: anything that is not a policy, rebound to the slot type
+template <typename T, typename... Policies> class queue {
+private:
+  using capacity_type =
+      typename detail::find_policy<detail::capacity_tag, dynamic_capacity,
+                                   Policies...>::type;
+  using layout_type =
+      typename detail::find_policy<detail::layout_tag, padded_slots,
+                                   Policies...>::type;
+  using slot_type = typename layout_type::template slot_type<T>;
+  using mapping_type = typename layout_type::template mapping<T>;
+  using wait_type =
+      typename detail::find_policy<detail::wait_tag, spin_wait,
+                                   Policies...>::type;
+  using producer_type =
+      typename detail::find_policy<detail::producer_tag, multi_producer,
+                                   Policies...>::type;
+  using consumer_type =
+      typename detail::find_policy<detail::consumer_tag, multi_consumer,
+                                   Policies...>::type;
+  using stats_type =
+      typename detail::find_policy<detail::stats_tag, no_stats,
+                                   Policies...>::type;
+  using notifier_type =
+      typename detail::find_policy<detail::notifier_tag, no_notifier,
+                                   Policies...>::type;
+  using overflow_type =
+      typename detail::find_policy<detail::overflow_tag, block_when_full,
+                                   Policies...>::type;
+  using ordering_type =
+      typename detail::find_policy<detail::ordering_tag, seq_cst_ordering,
+                                   Policies...>::type;
+  using prefetch_type =
+      typename detail::find_policy<detail::prefetch_tag, no_prefetch,
+                                   Policies...>::type;
+  using storage_type = typename detail::find_policy<
+      detail::storage_tag, heap_storage,
+      Policies...>::type::template storage<slot_type, capacity_type>;
+  using Allocator =
+      typename std::allocator_traits<typename detail::find_allocator<
+          aligned_allocator<slot_type>,
+          Policies...>::type>::template rebind_alloc<slot_type>;
+
+  static_assert(std::is_nothrow_copy_assignable<T>::value ||
+                    std::is_nothrow_move_assignable<T>::value,
+                "T must be nothrow copy or move assignable");
+
+  static_assert(std::is_nothrow_destructible<T>::value,
+                "T must be nothrow destructible");
+
+  static_assert(!overflow_type::overwrite ||
+                    std::is_same<consumer_type, multi_consumer>::value,
+                "overwrite_oldest needs multi_consumer");
+
+public:
+  explicit queue(const size_t capacity,
+                 const Allocator &alloc = Allocator())
+      : capacity_(capacity), mapping_(capacity_.capacity()),
+        sample_mask_(sample_mask(capacity_.capacity())), allocator_(alloc),
+        head_(0), tail_(0), closed_head_(std::numeric_limits<ticket_type>::max()), dropped_(0) {
+    init_();
+  }
+
+  /// constructs a queue whose capacity is fixed by static_capacity<N>
+  template <typename C = capacity_type,
+            typename = typename std::enable_if<
+                std::is_default_constructible<C>::value>::type>
+  explicit queue(const Allocator &alloc = Allocator())
+      : capacity_(), mapping_(capacity_.capacity()),
+        sample_mask_(sample_mask(capacity_.capacity())), allocator_(alloc),
+        head_(0), tail_(0), closed_head_(std::numeric_limits<ticket_type>::max()), dropped_(0) {
+    init_();
+  }
+
+  ~queue() noexcept {
+    // trivially destructible slots are released without being visited
+    if (!std::is_trivially_destructible<slot_type>::value) {
+      for (size_t i = 0; i < capacity_.capacity(); ++i) {
+        slots_[i].~slot_type();
+      }
+    }
+    slots_.deallocate(allocator_, capacity_.capacity());
+  }
+
+  // non-copyable and non-movable
+  queue(const queue &) = delete;
+  queue &operator=(const queue &) = delete;
+
+  /// enqueue an item constructed from args, blocks if queue is full. returns
+  /// false without enqueueing if the queue has been closed.
+  template <typename... Args> bool emplace(Args &&...args) noexcept {
+    static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
+                  "T must be nothrow constructible with Args&&...");
+    auto const head = producer_type::claim(head_, 1, ordering_type::rmw);
+    if (head & closed_bit) {
+      return false;
+    }
+    write_(head, std::forward<Args>(args)...);
+    return true;
+  }
+
+  template <typename... Args> bool try_emplace(Args &&...args) noexcept {
+    static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
+                  "T must be nothrow constructible with Args&&...");
+    if (overflow_type::overwrite) {
+      return emplace(std::forward<Args>(args)...);
+    }
+    ticket_type head;
+    if (!try_claim_head_(head)) {
+      return false;
+    }
+    publish_(head, std::forward<Args>(args)...);
+    return true;
+  }
+
+  /// enqueue an item constructed by f(void *p), which must construct exactly
+  /// one T at p without throwing. p is the storage of the slot so the item is
+  /// built in place without an intermediate copy. blocks if queue is full.
+  /// returns false without calling f if the queue has been closed.
+  template <typename F> bool emplace_with(F &&f) noexcept {
+    auto const head = producer_type::claim(head_, 1, ordering_type::rmw);
+    if (head & closed_bit) {
+      return false;
+    }
+    wait_free_(head);
+    publish_with_(head, std::forward<F>(f));
+    return true;
+  }
+
+  /// try to enqueue an item constructed in place by f(void *p). returns true
+  /// on success and false if queue is full, in which case f is not called.
+  template <typename F> bool try_emplace_with(F &&f) noexcept {
+    if (overflow_type::overwrite) {
+      return emplace_with(std::forward<F>(f));
+    }
+    ticket_type head;
+    if (!try_claim_head_(head)) {
+      return false;
+    }
+    publish_with_(head, std::forward<F>(f));
+    return true;
+  }
+
+  bool push(const T &v) noexcept {
+    static_assert(std::is_nothrow_copy_constructible<T>::value,
+                  "T must be nothrow copy constructible");
+    return emplace(v);
+  }
+
+  template <typename P,
+            typename = typename std::enable_if<
+                std::is_nothrow_constructible<T, P &&>::value>::type>
+  bool push(P &&v) noexcept {
+    return emplace(std::forward<P>(v));
+  }
+
+  bool try_push(const T &v) noexcept {
+    static_assert(std::is_nothrow_copy_constructible<T>::value,
+                  "T must be nothrow copy constructible");
+    return try_emplace(v);
+  }
+
+  template <typename P,
+            typename = typename std::enable_if<
+                std::is_nothrow_constructible<T, P &&>::value>::type>
+  bool try_push(P &&v) noexcept {
+    return try_emplace(std::forward<P>(v));
+  }
+
+  /// dequeue an item into v, blocks if queue is empty. returns false once
+  /// the queue has been closed and every item enqueued before has been
+  /// dequeued.
+  MPMC_NODISCARD bool pop(T &v) noexcept {
+    return read_(consumer_type::claim(tail_, 1, ordering_type::rmw), v);
+  }
+
+  /// like pop and also returns the sequence number of the item, its ticket.
+  /// a consumer that sees the sequence jump by more than one knows that the
+  /// items in between were dropped by overwrite_oldest or taken by another
+  /// consumer.
+  MPMC_NODISCARD bool pop(T &v, ticket_type &seq) noexcept {
+    seq = consumer_type::claim(tail_, 1, ordering_type::rmw);
+    return read_(seq, v);
+  }
+
+  bool try_pop(T &v) noexcept {
+    ticket_type tail;
+    if (!try_claim_tail_(tail)) {
+      return false;
+    }
+    consume_(tail, v);
+    return true;
+  }
+
+  /// like try_pop and also returns the sequence number of the item.
+  bool try_pop(T &v, ticket_type &seq) noexcept {
+    if (!try_claim_tail_(seq)) {
+      return false;
+    }
+    consume_(seq, v);
+    return true;
+  }
+
+  /// dequeue an item by calling f(T &) on it in place in its slot, the item is
+  /// destroyed when f returns. f must not throw. blocks if queue is empty.
+  /// returns false without calling f once the queue is closed and drained.
+  template <typename F> bool consume(F &&f) noexcept {
+    auto const tail = consumer_type::claim(tail_, 1, ordering_type::rmw);
+    if (!wait_readable_(tail)) {
+      return false;
+    }
+    visit_(tail, std::forward<F>(f));
+    return true;
+  }
+
+  /// try to dequeue an item by calling f(T &) on it in place. returns true on
+  /// success and false if the queue is empty, in which case f is not called.
+  template <typename F> bool try_consume(F &&f) noexcept {
+    ticket_type tail;
+    if (!try_claim_tail_(tail)) {
+      return false;
+    }
+    visit_(tail, std::forward<F>(f));
+    return true;
+  }
+
+#if defined(MPMC_HAS_COROUTINES)
+  /// awaitable of async_pop. the ticket is claimed when it is awaited, if
+  /// its slot is ready the item is taken synchronously, otherwise the
+  /// coroutine waits in the awaitable itself until a producer publishes the
+  /// slot and resumes it through the executor. a coroutine destroyed while
+  /// suspended here abandons its ticket, the item published for it is
+  /// destroyed so the slot moves on for everyone else. the node finishing
+  /// an abandoned ticket is allocated before a ticket that will wait is
+  /// claimed, so awaiting throws std::bad_alloc without claiming one when
+  /// the allocation fails.
+  template <typename Executor> class pop_awaitable : detail::async_waiter {
+  public:
+    pop_awaitable(queue &q, Executor ex) noexcept
+        : detail::async_waiter{&ready_, &resume_, nullptr, nullptr, 0}, q_(q),
+          executor_(std::move(ex)), tail_(0), suspended_(false),
+          reserve_(nullptr) {}
+
+    ~pop_awaitable() noexcept {
+      if (suspended_) {
+        q_.abandon_pop_(*this, tail_, reserve_);
+      } else {
+        ::operator delete(reserve_);
+      }
+    }
+
+    pop_awaitable(const pop_awaitable &) = delete;
+    pop_awaitable &operator=(const pop_awaitable &) = delete;
+
+    bool await_ready() {
+      if (!q_.pop_ready_(q_.tail_.load(std::memory_order_relaxed))) {
+        reserve_ = reserve_orphan_<abandoned_pop>();
+      }
+      tail_ = consumer_type::claim(q_.tail_, 1, ordering_type::rmw);
+      return q_.pop_ready_(tail_);
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+      if (reserve_ == nullptr) {
+        reserve_ = ::operator new(sizeof(abandoned_pop), std::nothrow);
+      }
+      if (reserve_ == nullptr) {
+        // the slot turned busy after the check and there is no memory to
+        // suspend safely, wait on the thread instead
+        (void)q_.wait_readable_(tail_);
+        return false;
+      }
+      handle_ = h;
+      suspended_ = true;
+      addr = &q_.slots_[q_.idx_(tail_)].turn;
+      key = q_.turn_(tail_) * 2 + 1;
+      return detail::async_lot::park(*this);
+    }
+
+    /// returns the item, or nothing once the queue is closed and drained
+    std::optional<T> await_resume() noexcept {
+      suspended_ = false;
+      std::optional<T> v;
+      if (q_.readable_(tail_)) {
+        q_.consume_(tail_, v);
+      }
+      return v;
+    }
+
+  private:
+    static bool ready_(detail::async_waiter *w) noexcept {
+      auto &self = *static_cast<pop_awaitable *>(w);
+      return self.q_.pop_ready_(self.tail_);
+    }
+
+    // the awaitable dies with the coroutine frame, resume from copies
+    static void resume_(detail::async_waiter *w) noexcept {
+      auto &self = *static_cast<pop_awaitable *>(w);
+      auto ex = self.executor_;
+      ex(self.handle_);
+    }
+
+    queue &q_;
+    Executor executor_;
+    ticket_type tail_;
+    bool suspended_;
+    void *reserve_;
+    std::coroutine_handle<> handle_;
+  };
+
+  /// awaitable of async_push, holds the item until its slot is free. a
+  /// coroutine destroyed while suspended here hands the item over to be
+  /// enqueued once its slot is free, so the ticket is always written. like
+  /// pop_awaitable it allocates the node for that before claiming a ticket
+  /// that will wait and throws std::bad_alloc without claiming one when the
+  /// allocation fails.
+  template <typename Executor> class push_awaitable : detail::async_waiter {
+  public:
+    template <typename P>
+    push_awaitable(queue &q, P &&v, Executor ex) noexcept
+        : detail::async_waiter{&ready_, &resume_, nullptr, nullptr, 0}, q_(q),
+          executor_(std::move(ex)), head_(0), suspended_(false),
+          reserve_(nullptr), value_(std::forward<P>(v)) {}
+
+    ~push_awaitable() noexcept {
+      if (suspended_) {
+        q_.abandon_push_(*this, head_, std::move(value_), reserve_);
+      } else {
+        ::operator delete(reserve_);
+      }
+    }
+
+    push_awaitable(const push_awaitable &) = delete;
+    push_awaitable &operator=(const push_awaitable &) = delete;
+
+    bool await_ready() {
+      auto const head = q_.head_.load(std::memory_order_relaxed);
+      if ((head & closed_bit) == 0 && !q_.push_ready_(head)) {
+        reserve_ = reserve_orphan_<abandoned_push>();
+      }
+      head_ = producer_type::claim(q_.head_, 1, ordering_type::rmw);
+      return (head_ & closed_bit) != 0 || q_.push_ready_(head_);
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+      if (reserve_ == nullptr) {
+        reserve_ = ::operator new(sizeof(abandoned_push), std::nothrow);
+      }
+      if (reserve_ == nullptr) {
+        // see pop_awaitable
+        q_.wait_writable_(head_);
+        return false;
+      }
+      handle_ = h;
+      suspended_ = true;
+      addr = &q_.slots_[q_.idx_(head_)].turn;
+      key = q_.turn_(head_) * 2;
+      return detail::async_lot::park(*this);
+    }
+
+    /// returns false without enqueueing if the queue has been closed
+    bool await_resume() noexcept {
+      suspended_ = false;
+      if (head_ & closed_bit) {
+        return false;
+      }
+      q_.publish_(head_, std::move(value_));
+      return true;
+    }
+
+  private:
+    static bool ready_(detail::async_waiter *w) noexcept {
+      auto &self = *static_cast<push_awaitable *>(w);
+      return self.q_.push_ready_(self.head_);
+    }
+
+    static void resume_(detail::async_waiter *w) noexcept {
+      auto &self = *static_cast<push_awaitable *>(w);
+      auto ex = self.executor_;
+      ex(self.handle_);
+    }
+
+    queue &q_;
+    Executor executor_;
+    ticket_type head_;
+    bool suspended_;
+    void *reserve_;
+    T value_;
+    std::coroutine_handle<> handle_;
+  };
+
+  /// co_await q.async_pop() dequeues an item without blocking the thread,
+  /// the coroutine is resumed through ex once an item is there or the
+  /// queue is closed and drained. needs the coroutine_wait policy.
+  template <typename Executor = inline_executor>
+  pop_awaitable<Executor> async_pop(Executor ex = Executor()) noexcept {
+    static_assert(std::is_base_of<coroutine_wait, wait_type>::value,
+                  "async operations need the coroutine_wait policy");
+    return pop_awaitable<Executor>(*this, std::move(ex));
+  }
+
+  /// co_await q.async_push(v) enqueues v without blocking the thread, the
+  /// coroutine is resumed through ex once a slot is free. returns false if
+  /// the queue has been closed. needs the coroutine_wait policy.
+  template <typename P, typename Executor = inline_executor,
+            typename = typename std::enable_if<
+                std::is_nothrow_constructible<T, P &&>::value>::type>
+  push_awaitable<Executor> async_push(P &&v, Executor ex = Executor()) noexcept {
+    static_assert(std::is_base_of<coroutine_wait, wait_type>::value,
+                  "async operations need the coroutine_wait policy");
+    return push_awaitable<Executor>(*this, std::forward<P>(v), std::move(ex));
+  }
+#endif
+
+  /// try to enqueue an item using copy construction, waiting until the
+  /// deadline for a free slot. returns true on success and false if the queue
+  /// stayed full until the deadline.
+  template <typename Clock, typename Duration>
+  bool
+  try_push_until(const T &v,
+                 const std::chrono::time_point<Clock, Duration> &deadline) noexcept {
+    static_assert(std::is_nothrow_copy_constructible<T>::value,
+                  "T must be nothrow copy constructible");
+    return try_emplace_until_(deadline, v);
+  }
+
+  template <typename P, typename Clock, typename Duration,
+            typename = typename std::enable_if<
+                std::is_nothrow_constructible<T, P &&>::value>::type>
+  bool
+  try_push_until(P &&v,
+                 const std::chrono::time_point<Clock, Duration> &deadline) noexcept {
+    return try_emplace_until_(deadline, std::forward<P>(v));
+  }
+
+  /// try to enqueue an item using copy construction, waiting up to timeout
+  /// for a free slot.
+  template <typename Rep, typename Period>
+  bool try_push_for(const T &v,
+                    const std::chrono::duration<Rep, Period> &timeout) noexcept {
+    return try_push_until(v, std::chrono::steady_clock::now() + timeout);
+  }
+
+  template <typename P, typename Rep, typename Period,
+            typename = typename std::enable_if<
+                std::is_nothrow_constructible<T, P &&>::value>::type>
+  bool try_push_for(P &&v,
+                    const std::chrono::duration<Rep, Period> &timeout) noexcept {
+    return try_push_until(std::forward<P>(v),
+                          std::chrono::steady_clock::now() + timeout);
+  }
+
+  /// try to dequeue an item into v, waiting until the deadline for an item.
+  /// returns true on success and false if the queue stayed empty until the
+  /// deadline or is closed and drained.
+  template <typename Clock, typename Duration>
+  bool
+  try_pop_until(T &v,
+                const std::chrono::time_point<Clock, Duration> &deadline) noexcept {
+    for (;;) {
+      if (try_pop(v)) {
+        return true;
+      }
+      auto const tail = tail_.load(ordering_type::load);
+      if (tail >= closed_head_.load(std::memory_order_acquire)) {
+        return false;
+      }
+      auto &slot = slots_[idx_(tail)];
+      auto const turn = turn_(tail) * 2 + 1;
+      // wake up when the slot is ready, another consumer took the ticket or
+      // the queue was closed before it
+      if (!wait_type::wait_until(
+              slot.turn,
+              [this, &slot, tail, turn]() noexcept {
+                return turn == slot.turn.load(std::memory_order_acquire) ||
+                       tail != tail_.load(std::memory_order_relaxed) ||
+                       tail >= closed_head_.load(std::memory_order_acquire);
+              },
+              deadline)) {
+        return try_pop(v);
+      }
+    }
+  }
+
+  /// try to dequeue an item into v, waiting up to timeout for an item.
+  template <typename Rep, typename Period>
+  bool try_pop_for(T &v,
+                   const std::chrono::duration<Rep, Period> &timeout) noexcept {
+    return try_pop_until(v, std::chrono::steady_clock::now() + timeout);
+  }
+
+  /// enqueue the items in [first, last) using copy construction from *first.
+  /// all tickets are claimed with a single atomic operation on the head.
+  /// blocks until every item has been enqueued. returns false without
+  /// enqueueing any item if the queue has been closed.
+  template <typename ForwardIt>
+  bool push_n(ForwardIt first, ForwardIt last) noexcept {
+    auto const n = static_cast<size_t>(std::distance(first, last));
+    if (n == 0) {
+      return true;
+    }
+    auto const head = producer_type::claim(head_, n, ordering_type::rmw);
+    if (head & closed_bit) {
+      return false;
+    }
+    for (size_t i = 0; i < n; ++i, ++first) {
+      write_(head + i, *first);
+    }
+    return true;
+  }
+
+  /// try to enqueue the items in [first, last). claims as many consecutive
+  /// free slots as are available with a single atomic operation on the head
+  /// and returns the number of items enqueued, which is a prefix of the range.
+  template <typename ForwardIt>
+  size_t try_push_n(ForwardIt first, ForwardIt last) noexcept {
+    auto const n = static_cast<size_t>(std::distance(first, last));
+    if (overflow_type::overwrite) {
+      return push_n(first, last) ? n : 0;
+    }
+    auto head = head_.load(ordering_type::load);
+    for (;;) {
+      if (head & closed_bit) {
+        return 0;
+      }
+      size_t count = 0;
+      while (count < n &&
+             turn_(head + count) * 2 ==
+                 slots_[idx_(head + count)].turn.load(
+                     std::memory_order_acquire)) {
+        ++count;
+      }
+      if (count != 0) {
+        if (producer_type::try_claim(head_, head, count,
+                                     ordering_type::rmw)) {
+          for (size_t i = 0; i < count; ++i, ++first) {
+            publish_(head + i, *first);
+          }
+          return count;
+        }
+        stats_.cas_retry();
+      } else {
+        auto const prev_head = head;
+        head = head_.load(ordering_type::load);
+        if (head == prev_head) {
+          if (n != 0) {
+            stats_.full();
+          }
+          return 0;
+        }
+      }
+    }
+  }
+
+  /// dequeue n items by copying or moving them into out. all tickets are
+  /// claimed with a single atomic operation on the tail. blocks until n items
+  /// have been dequeued and returns the output iterator past the last item.
+  /// if the queue is closed and drained on the way fewer items are dequeued.
+  template <typename OutputIt> OutputIt pop_n(OutputIt out, size_t n) noexcept {
+    if (n == 0) {
+      return out;
+    }
+    auto const tail = consumer_type::claim(tail_, n, ordering_type::rmw);
+    for (size_t i = 0; i < n; ++i, ++out) {
+      // the tickets after a closed one are closed as well
+      if (!read_(tail + i, *out)) {
+        break;
+      }
+    }
+    return out;
+  }
+
+  /// try to dequeue up to max items into out. claims as many consecutive
+  /// ready slots as are available with a single atomic operation on the tail
+  /// and returns the number of items dequeued.
+  template <typename OutputIt>
+  size_t try_pop_n(OutputIt out, size_t max) noexcept {
+    auto tail = tail_.load(ordering_type::load);
+    for (;;) {
+      size_t count = 0;
+      while (count < max &&
+             turn_(tail + count) * 2 + 1 ==
+                 slots_[idx_(tail + count)].turn.load(
+                     std::memory_order_acquire)) {
+        ++count;
+      }
+      if (count != 0) {
+        if (consumer_type::try_claim(tail_, tail, count,
+                                     ordering_type::rmw)) {
+          for (size_t i = 0; i < count; ++i, ++out) {
+            consume_(tail + i, *out);
+          }
+          return count;
+        }
+        stats_.cas_retry();
+      } else {
+        auto const prev_tail = tail;
+        tail = tail_.load(ordering_type::load);
+        if (tail == prev_tail) {
+          if (max != 0) {
+            stats_.empty();
+          }
+          return 0;
+        }
+      }
+    }
+  }
+
+  /// try to dequeue whatever is ready, up to max items, into out. the head
+  /// is read once to bound the claim to the tickets producers have taken,
+  /// then the published prefix of those is claimed with a single atomic
+  /// operation on the tail, so it never waits and never claims a slot that
+  /// is still being written. returns the number of items dequeued.
+  template <typename OutputIt>
+  size_t try_pop_bulk(OutputIt out, size_t max) noexcept {
+    auto const head = head_.load(ordering_type::load) & ~closed_bit;
+    auto tail = tail_.load(ordering_type::load);
+    for (;;) {
+      auto const avail =
+          head > tail
+              ? static_cast<size_t>(std::min<ticket_type>(max, head - tail))
+              : 0;
+      size_t count = 0;
+      while (count < avail &&
+             turn_(tail + count) * 2 + 1 ==
+                 slots_[idx_(tail + count)].turn.load(
+                     std::memory_order_acquire)) {
+        ++count;
+      }
+      if (count == 0) {
+        if (max != 0) {
+          stats_.empty();
+        }
+        return 0;
+      }
+      // a failed claim reloads the tail and retries below the same head
+      if (consumer_type::try_claim(tail_, tail, count, ordering_type::rmw)) {
+        for (size_t i = 0; i < count; ++i, ++out) {
+          consume_(tail + i, *out);
+        }
+        return count;
+      }
+      stats_.cas_retry();
+    }
+  }
+
+  /// a producer handle for one thread that gathers up to block items and
+  /// enqueues them with push_n, so the head is touched once per block
+  /// instead of once per item. tickets are only claimed for items that
+  /// exist and every claimed ticket is written, so consumers never wait on
+  /// a hole. the queue is only looked at when a block starts: a push that
+  /// finds the queue closed fails and one that finds it drained is enqueued
+  /// at once, so consumers that keep up see every item as soon as it is
+  /// pushed. the other items of a block are gathered without touching the
+  /// queue, they stay invisible to consumers until the block is full,
+  /// flush is called or the token is destroyed, which flushes. a producer
+  /// that goes idle must flush, its gathered items wait for the next push
+  /// otherwise. items gathered after a close are dropped by the next flush,
+  /// which reports how many it dropped.
+  class producer_token {
+  public:
+    explicit producer_token(queue &q, size_t block = 32)
+        : q_(q), block_(std::max<size_t>(
+                     1, std::min(block, q.capacity_.capacity()))) {
+      items_.reserve(block_);
+    }
+
+    /// flushes, pending items are dropped if the queue has been closed
+    ~producer_token() noexcept { flush(); }
+
+    producer_token(const producer_token &) = delete;
+    producer_token &operator=(const producer_token &) = delete;
+
+    /// add an item to the block, blocks if the block is full and the queue
+    /// has no room for it. returns false if the item starts a block and the
+    /// queue has been closed, or the flush of a full block finds it closed.
+    template <typename... Args> bool emplace(Args &&...args) noexcept {
+      static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
+                    "T must be nothrow constructible with Args&&...");
+      if (items_.empty()) {
+        bool drained;
+        if (!start_(drained)) {
+          return false;
+        }
+        if (drained) {
+          return q_.emplace(std::forward<Args>(args)...);
+        }
+      }
+      items_.emplace_back(std::forward<Args>(args)...);
+      return items_.size() < block_ || flush() == 0;
+    }
+
+    /// try to add an item to the block. returns false if the block is full
+    /// and the queue has no room for any of it, or the item starts a block
+    /// and the queue has been closed.
+    template <typename... Args> bool try_emplace(Args &&...args) noexcept {
+      static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
+                    "T must be nothrow constructible with Args&&...");
+      if (items_.empty()) {
+        bool drained;
+        if (!start_(drained)) {
+          return false;
+        }
+        if (drained) {
+          return q_.try_emplace(std::forward<Args>(args)...);
+        }
+      }
+      if (items_.size() == block_ && !try_flush_()) {
+        return false;
+      }
+      items_.emplace_back(std::forward<Args>(args)...);
+      if (items_.size() == block_) {
+        try_flush_();
+      }
+      return true;
+    }
+
+    bool push(const T &v) noexcept { return emplace(v); }
+
+    template <typename P,
+              typename = typename std::enable_if<
+                  std::is_nothrow_constructible<T, P &&>::value>::type>
+    bool push(P &&v) noexcept {
+      return emplace(std::forward<P>(v));
+    }
+
+    bool try_push(const T &v) noexcept { return try_emplace(v); }
+
+    template <typename P,
+              typename = typename std::enable_if<
+                  std::is_nothrow_constructible<T, P &&>::value>::type>
+    bool try_push(P &&v) noexcept {
+      return try_emplace(std::forward<P>(v));
+    }
+
+    /// enqueue the pending items under a single claim, blocks until all of
+    /// them have been enqueued. returns the number of pending items dropped
+    /// because the queue has been closed, 0 once all of them are enqueued.
+    size_t flush() noexcept {
+      auto const n = items_.size();
+      auto const pushed =
+          q_.push_n(std::make_move_iterator(items_.begin()),
+                    std::make_move_iterator(items_.end()));
+      items_.clear();
+      return pushed ? 0 : n;
+    }
+
+    /// returns the number of items waiting for the next flush
+    size_t size() const noexcept { return items_.size(); }
+
+  private:
+    // looks at the queue once per block, returns false if it is closed and
+    // sets drained if no item is waiting in it
+    bool start_(bool &drained) const noexcept {
+      auto const head = q_.head_.load(std::memory_order_relaxed);
+      if (head & closed_bit) {
+        return false;
+      }
+      auto const tail = q_.tail_.load(std::memory_order_relaxed);
+      drained = static_cast<int64_t>(head - tail) <= 0;
+      return true;
+    }
+
+    // enqueues the prefix of the pending items that fits and keeps the rest
+    bool try_flush_() noexcept {
+      auto const n = q_.try_push_n(std::make_move_iterator(items_.begin()),
+                                   std::make_move_iterator(items_.end()));
+      items_.erase(items_.begin(),
+                   items_.begin() + static_cast<ptrdiff_t>(n));
+      return n != 0;
+    }
+
+    queue &q_;
+    const size_t block_;
+    std::vector<T> items_;
+  };
+
+  /// a consumer handle for one thread that dequeues up to block ready items
+  /// with try_pop_bulk and hands them out one by one, so the tail is touched
+  /// once per block instead of once per item. when nothing is ready it falls
+  /// back to the shared tail with pop. items held by the token have left
+  /// the queue and are never given back, which would put them behind newer
+  /// items. the owner must take every held item out with pop, try_pop or
+  /// drain before destroying the token, destroying a token that still
+  /// holds items calls std::terminate, also in release builds, since the
+  /// items would be lost without a trace.
+  class consumer_token {
+  public:
+    explicit consumer_token(queue &q, size_t block = 32)
+        : q_(q), block_(std::max<size_t>(
+                     1, std::min(block, q.capacity_.capacity()))),
+          next_(0) {
+      items_.reserve(block_);
+    }
+
+    ~consumer_token() noexcept {
+      if (size() != 0) {
+        std::terminate();
+      }
+    }
+
+    consumer_token(const consumer_token &) = delete;
+    consumer_token &operator=(const consumer_token &) = delete;
+
+    /// dequeue an item into v, blocks if the token and the queue are empty.
+    /// returns false once the queue has been closed and drained.
+    MPMC_NODISCARD bool pop(T &v) noexcept {
+      if (next_ != items_.size() || refill_()) {
+        v = std::move(items_[next_++]);
+        return true;
+      }
+      return q_.pop(v);
+    }
+
+    bool try_pop(T &v) noexcept {
+      if (next_ != items_.size() || refill_()) {
+        v = std::move(items_[next_++]);
+        return true;
+      }
+      return false;
+    }
+
+    /// move the held items to out in order without touching the queue.
+    /// returns the number of items moved, the token holds none afterwards.
+    template <typename OutputIt> size_t drain(OutputIt out) noexcept {
+      auto const n = size();
+      for (; next_ != items_.size(); ++next_, ++out) {
+        *out = std::move(items_[next_]);
+      }
+      items_.clear();
+      next_ = 0;
+      return n;
+    }
+
+    /// returns the number of items held by the token
+    size_t size() const noexcept { return items_.size() - next_; }
+
+  private:
+    bool refill_() noexcept {
+      items_.clear();
+      next_ = 0;
+      return q_.try_pop_bulk(std::back_inserter(items_), block_) != 0;
+    }
+
+    queue &q_;
+    const size_t block_;
+    std::vector<T> items_;
+    size_t next_;
+  };
+
+  /// returns the number of elements in the queue.
+  /// the size can be negative when the queue is empty and there is at least one
+  /// reader waiting, and larger than the capacity when the queue is full and
+  /// there is at least one writer waiting. tickets are 64 bit and never wrap
+  /// so the difference is exact on every platform. the tail is loaded before
+  /// the head so that concurrent pops cannot make the size undercount. since
+  /// this is a concurrent queue the size is only a best effort guess until all
+  /// reader and writer threads have been joined.
+  /// once the queue is closed the size counts the items left to drain.
+  ptrdiff_t size() const noexcept {
+    auto const tail = tail_.load(std::memory_order_acquire);
+    auto const head = head_.load(std::memory_order_relaxed);
+    if (head & closed_bit) {
+      // producers keep bumping the head while failing after close
+      auto const closed_head = std::min(head & ~closed_bit,
+                                        closed_head_.load(
+                                            std::memory_order_relaxed));
+      return closed_head > tail
+                 ? static_cast<ptrdiff_t>(closed_head - tail)
+                 : 0;
+    }
+    return static_cast<ptrdiff_t>(static_cast<int64_t>(head - tail));
+  }
+
+  /// returns true if the queue is empty.
+  /// since this is a concurrent queue this is only a best effort guess
+  /// until all reader and writer threads have been joined.
+  bool empty() const noexcept { return size() <= 0; }
+
+  /// returns true if the queue is full, a best effort guess like empty.
+  bool full() const noexcept {
+    return size() >= static_cast<ptrdiff_t>(capacity());
+  }
+
+  size_t capacity() const noexcept { return capacity_.capacity(); }
+
+  /// returns the number of elements in the queue in [0, capacity]. with a
+  /// stats policy it is computed from copies of the head and tail that
+  /// producers and consumers raise every sample interval tickets, the
+  /// largest power of two not above capacity / 8 capped at 64. so polling it
+  /// does not pull the cache lines of the head and tail away from producers
+  /// and consumers, at the price of being off by up to one sample interval.
+  /// without one the queue keeps no copies and it loads the head and tail
+  /// like size.
+  size_t approx_size() const noexcept {
+    auto const n = stats_type::enabled
+                       ? static_cast<int64_t>(stats_.head_sample() -
+                                              stats_.tail_sample())
+                       : static_cast<int64_t>(size());
+    auto const cap = static_cast<int64_t>(capacity());
+    return static_cast<size_t>(n <= 0 ? 0 : n >= cap ? cap : n);
+  }
+
+  /// returns the number of items dropped by overwrite_oldest.
+  uint64_t dropped() const noexcept {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+  /// returns a snapshot of the counters kept by the stats policy, all zero
+  /// with no_stats. counters are updated with relaxed operations so the
+  /// snapshot is only exact once all threads have been joined.
+  queue_stats stats() const noexcept { return stats_.snapshot(); }
+
+  /// closes the queue without blocking. producers fail from now on, items
+  /// enqueued before stay in the queue and consumers, blocked or not, keep
+  /// dequeuing them until it is drained, after which they return false.
+  /// every waiting thread is woken to observe the close. the close is a bit
+  /// in the head so the fast paths test the ticket they already hold instead
+  /// of loading a flag. closing twice has no effect. with single_producer
+  /// close must be called by the producer thread, since it does not update
+  /// the head atomically.
+  void close() noexcept {
+    auto const head = head_.fetch_or(closed_bit, std::memory_order_seq_cst);
+    if (head & closed_bit) {
+      return;
+    }
+    closed_head_.store(head, std::memory_order_seq_cst);
+    wait_type::notify_all();
+    notifier_.notify();
+  }
+
+  /// returns true if the queue has been closed.
+  bool closed() const noexcept {
+    return (head_.load(std::memory_order_acquire) & closed_bit) != 0;
+  }
+
+  /// returns the handle of the notifier policy to poll for readability in
+  /// an event loop, eg with epoll or io_uring.
+  int native_handle() const noexcept {
+    static_assert(notifier_type::enabled, "native_handle needs a notifier");
+    return notifier_.native_handle();
+  }
+
+  /// arms the notifier before the consumer polls native_handle. returns true
+  /// if the queue had no ready item, the handle then becomes readable on the
+  /// next publish or close. returns false with the notifier disarmed if an
+  /// item is ready or the queue is closed, and the consumer should pop
+  /// instead of polling. since the check races with producers the handle
+  /// can also be readable spuriously.
+  bool arm() noexcept {
+    static_assert(notifier_type::enabled, "arm needs a notifier");
+    notifier_.arm();
+    auto const tail = tail_.load(ordering_type::load);
+    if (turn_(tail) * 2 + 1 ==
+            slots_[idx_(tail)].turn.load(std::memory_order_acquire) ||
+        closed()) {
+      notifier_.disarm();
+      return false;
+    }
+    return true;
+  }
+
+  /// consumes the readiness of native_handle once it polled readable.
+  void acknowledge() noexcept {
+    static_assert(notifier_type::enabled, "acknowledge needs a notifier");
+    notifier_.acknowledge();
+  }
+
+private:
+  // the top bit of the head marks a closed queue, tickets never reach it
+  static constexpr ticket_type closed_bit = ticket_type(1) << 63;
+
+  void init_() {
+    slots_.allocate(allocator_, capacity_.capacity());
+    for (size_t i = 0; i < capacity_.capacity(); ++i) {
+      new (&slots_[i]) slot_type();
+    }
+    static_assert(
+        !layout_type::padded ||
+            alignof(slot_type) == hardware_interference_size,
+        "slot must be aligned to cache line boundary to prevent false sharing");
+    static_assert(!layout_type::padded ||
+                      sizeof(slot_type) % hardware_interference_size == 0,
+                  "slot size must be a multiple of cache line size to prevent "
+                  "false sharing between adjacent slots");
+    static_assert(sizeof(queue) % hardware_interference_size == 0,
+                  "queue size must be a multiple of cache line size to "
+                  "prevent false sharing between adjacent queues");
+    static_assert(
+        offsetof(queue, tail_) - offsetof(queue, head_) ==
+            static_cast<std::ptrdiff_t>(hardware_interference_size),
+        "head and tail must be a cache line apart to prevent false sharing");
+  }
+
+  template <typename Deadline, typename... Args>
+  bool try_emplace_until_(const Deadline &deadline, Args &&...args) noexcept {
+    for (;;) {
+      // args are only consumed when try_emplace succeeds
+      if (try_emplace(std::forward<Args>(args)...)) {
+        return true;
+      }
+      auto const head = head_.load(ordering_type::load);
+      if (head & closed_bit) {
+        return false;
+      }
+      auto &slot = slots_[idx_(head)];
+      auto const turn = turn_(head) * 2;
+      // wake up when the slot is free or another producer took the ticket
+      if (!wait_type::wait_until(
+              slot.turn,
+              [this, &slot, head, turn]() noexcept {
+                return turn == slot.turn.load(std::memory_order_acquire) ||
+                       head != head_.load(std::memory_order_relaxed);
+              },
+              deadline)) {
+        return try_emplace(std::forward<Args>(args)...);
+      }
+    }
+  }
+
+  // claims the ticket at the head if its slot is free, returns false if the
+  // queue is full or closed. the closed head must be rejected explicitly
+  // since its turn may wrap around to a free one
+  bool try_claim_head_(ticket_type &head) noexcept {
+    head = head_.load(ordering_type::load);
+    for (;;) {
+      if (head & closed_bit) {
+        return false;
+      }
+      auto &slot = slots_[idx_(head)];
+      if (turn_(head) * 2 == slot.turn.load(std::memory_order_acquire)) {
+        if (producer_type::try_claim(head_, head, 1, ordering_type::rmw)) {
+          return true;
+        }
+        stats_.cas_retry();
+      } else {
+        auto const prev_head = head;
+        head = head_.load(ordering_type::load);
+        if (head == prev_head) {
+          stats_.full();
+          return false;
+        }
+      }
+    }
+  }
+
+  // claims the ticket at the tail if its slot is ready, returns false if the
+  // queue is empty
+  bool try_claim_tail_(ticket_type &tail) noexcept {
+    tail = tail_.load(ordering_type::load);
+    for (;;) {
+      auto &slot = slots_[idx_(tail)];
+      if (turn_(tail) * 2 + 1 == slot.turn.load(std::memory_order_acquire)) {
+        if (consumer_type::try_claim(tail_, tail, 1, ordering_type::rmw)) {
+          return true;
+        }
+        stats_.cas_retry();
+      } else {
+        auto const prev_tail = tail;
+        tail = tail_.load(ordering_type::load);
+        if (tail == prev_tail) {
+          stats_.empty();
+          return false;
+        }
+      }
+    }
+  }
+
+#if defined(MPMC_HAS_COROUTINES)
+  bool readable_(ticket_type const tail) const noexcept {
+    return slots_[idx_(tail)].turn.load(std::memory_order_acquire) ==
+           turn_(tail) * 2 + 1;
+  }
+
+  // an async pop can complete once its slot is published or the queue was
+  // closed before its ticket
+  bool pop_ready_(ticket_type const tail) const noexcept {
+    return readable_(tail) ||
+           tail >= closed_head_.load(std::memory_order_acquire);
+  }
+
+  bool push_ready_(ticket_type const head) const noexcept {
+    return slots_[idx_(head)].turn.load(std::memory_order_acquire) ==
+           turn_(head) * 2;
+  }
+
+  // allocates the node finishing the ticket of a coroutine destroyed while
+  // suspended, throws std::bad_alloc to the awaiter before it claims a
+  // ticket
+  template <typename Orphan> static void *reserve_orphan_() {
+    auto *p = ::operator new(sizeof(Orphan), std::nothrow);
+    if (p == nullptr) {
+      throw std::bad_alloc();
+    }
+    return p;
+  }
+
+  // the ticket of a destroyed coroutine, parked in its place until the
+  // slot turns and then completed by the notifier. built in the node the
+  // awaitable reserved
+  struct abandoned_pop : detail::async_waiter {
+    abandoned_pop(queue &q, ticket_type const tail) noexcept
+        : detail::async_waiter{&ready_, &resume_, nullptr,
+                               &q.slots_[q.idx_(tail)].turn,
+                               q.turn_(tail) * 2 + 1},
+          q(q), tail(tail) {}
+
+    static bool ready_(detail::async_waiter *w) noexcept {
+      auto &self = *static_cast<abandoned_pop *>(w);
+      return self.q.pop_ready_(self.tail);
+    }
+
+    static void resume_(detail::async_waiter *w) noexcept {
+      auto *self = static_cast<abandoned_pop *>(w);
+      self->q.discard_(self->tail);
+      self->~abandoned_pop();
+      ::operator delete(self);
+    }
+
+    queue &q;
+    ticket_type tail;
+  };
+
+  struct abandoned_push : detail::async_waiter {
+    abandoned_push(queue &q, ticket_type const head, T &&v) noexcept
+        : detail::async_waiter{&ready_, &resume_, nullptr,
+                               &q.slots_[q.idx_(head)].turn,
+                               q.turn_(head) * 2},
+          q(q), head(head), value(std::move(v)) {}
+
+    static bool ready_(detail::async_waiter *w) noexcept {
+      auto &self = *static_cast<abandoned_push *>(w);
+      return self.q.push_ready_(self.head);
+    }
+
+    static void resume_(detail::async_waiter *w) noexcept {
+      auto *self = static_cast<abandoned_push *>(w);
+      self->q.publish_(self->head, std::move(self->value));
+      self->~abandoned_push();
+      ::operator delete(self);
+    }
+
+    queue &q;
+    ticket_type head;
+    T value;
+  };
+
+  // destroys the item of the ticket tail, if the close did not come first
+  void discard_(ticket_type const tail) noexcept {
+    if (readable_(tail)) {
+      visit_(tail, [](T &) noexcept {});
+    }
+  }
+
+  // completes the async pop of a destroyed coroutine parked as w. the
+  // ticket is finished now if its slot is ready, otherwise an
+  // abandoned_pop built in reserve takes over the wait. the queue must
+  // outlive it
+  void abandon_pop_(detail::async_waiter &w, ticket_type const tail,
+                    void *reserve) noexcept {
+    detail::async_lot::cancel(w);
+    if (pop_ready_(tail)) {
+      discard_(tail);
+      ::operator delete(reserve);
+      return;
+    }
+    auto *orphan = new (reserve) abandoned_pop(*this, tail);
+    if (!detail::async_lot::park(*orphan)) {
+      abandoned_pop::resume_(orphan);
+    }
+  }
+
+  // completes the async push of a destroyed coroutine parked as w, like
+  // abandon_pop_ the item is enqueued now or once its slot is free
+  void abandon_push_(detail::async_waiter &w, ticket_type const head,
+                     T &&v, void *reserve) noexcept {
+    detail::async_lot::cancel(w);
+    if (push_ready_(head)) {
+      publish_(head, std::move(v));
+      ::operator delete(reserve);
+      return;
+    }
+    auto *orphan = new (reserve) abandoned_push(*this, head, std::move(v));
+    if (!detail::async_lot::park(*orphan)) {
+      abandoned_push::resume_(orphan);
+    }
+  }
+#endif
+
+  // waits for the turn of the ticket head to write its slot
+  void wait_writable_(ticket_type const head) noexcept {
+    auto &slot = slots_[idx_(head)];
+    auto const turn = turn_(head) * 2;
+    wait_type::wait(slot.turn, [this, &slot, turn]() noexcept {
+      if (turn == slot.turn.load(std::memory_order_acquire)) {
+        return true;
+      }
+      stats_.spin();
+      return false;
+    });
+  }
+
+  // waits for the turn of the ticket tail to read its slot, returns false if
+  // the queue was closed before the ticket so its turn never comes. the
+  // close is only checked while waiting
+  bool wait_readable_(ticket_type const tail) noexcept {
+    auto &slot = slots_[idx_(tail)];
+    auto const turn = turn_(tail) * 2 + 1;
+    bool readable = false;
+    wait_type::wait(slot.turn, [this, &slot, turn, tail, &readable]() noexcept {
+      if (turn == slot.turn.load(std::memory_order_acquire)) {
+        readable = true;
+        return true;
+      }
+      stats_.spin();
+      return tail >= closed_head_.load(std::memory_order_acquire);
+    });
+    return readable;
+  }
+
+  // waits until the slot of the ticket head is free, or with
+  // overwrite_oldest frees it by dropping the oldest items while the queue
+  // is full
+  void wait_free_(ticket_type const head) noexcept {
+    if (overflow_type::overwrite) {
+      auto &slot = slots_[idx_(head)];
+      auto const turn = turn_(head) * 2;
+      auto const capacity = static_cast<ticket_type>(capacity_.capacity());
+      while (turn != slot.turn.load(std::memory_order_acquire)) {
+        auto tail = tail_.load(ordering_type::load);
+        if (tail + capacity > head) {
+          // a consumer claimed the previous item of the slot and is reading
+          // it, the tail only grows so the queue stays not full
+          break;
+        }
+        if (consumer_type::try_claim(tail_, tail, 1, ordering_type::rmw)) {
+          drop_(tail);
+        } else {
+          stats_.cas_retry();
+        }
+      }
+    }
+    wait_writable_(head);
+  }
+
+  // destroys the item of the ticket tail claimed by a producer
+  void drop_(ticket_type const tail) noexcept {
+    wait_readable_(tail);
+    visit_(tail, [](T &) noexcept {});
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // waits for the turn of the ticket head and writes its slot
+  template <typename... Args>
+  void write_(ticket_type const head, Args &&...args) noexcept {
+    wait_free_(head);
+    publish_(head, std::forward<Args>(args)...);
+  }
+
+  // constructs the element of the ticket head whose turn has been observed
+  template <typename... Args>
+  void publish_(ticket_type const head, Args &&...args) noexcept {
+    prefetch_<true>(head);
+    auto &slot = slots_[idx_(head)];
+    slot.construct(std::forward<Args>(args)...);
+    slot.turn.store(turn_(head) * 2 + 1, std::memory_order_release);
+    wait_type::notify(slot.turn);
+    notifier_.notify();
+    record_occupancy_(head);
+  }
+
+  // lets f construct the element of the ticket head in the slot storage
+  template <typename F>
+  void publish_with_(ticket_type const head, F &&f) noexcept {
+    prefetch_<true>(head);
+    auto &slot = slots_[idx_(head)];
+    f(slot.data());
+    slot.turn.store(turn_(head) * 2 + 1, std::memory_order_release);
+    wait_type::notify(slot.turn);
+    notifier_.notify();
+    record_occupancy_(head);
+  }
+
+  // records the number of elements in the queue after the ticket head was
+  // published for approx_size and the stats policy, compiles away without
+  // stats
+  void record_occupancy_(ticket_type const head) noexcept {
+    if (stats_type::enabled) {
+      stats_.sample_head(head, sample_mask_);
+      stats_.occupancy(static_cast<ptrdiff_t>(
+          head + 1 - tail_.load(std::memory_order_relaxed)));
+    }
+  }
+
+  // waits for the turn of the ticket tail and reads its slot into v, returns
+  // false if the queue was closed before the ticket
+  template <typename U> bool read_(ticket_type const tail, U &&v) noexcept {
+    if (!wait_readable_(tail)) {
+      return false;
+    }
+    consume_(tail, std::forward<U>(v));
+    return true;
+  }
+
+  // moves out the element of the ticket tail whose turn has been observed
+  template <typename U> void consume_(ticket_type const tail, U &&v) noexcept {
+    prefetch_<false>(tail);
+    auto &slot = slots_[idx_(tail)];
+    v = slot.move();
+    slot.destroy();
+    slot.turn.store(turn_(tail) * 2 + 2, std::memory_order_release);
+    wait_type::notify(slot.turn);
+    if (stats_type::enabled) {
+      stats_.sample_tail(tail, sample_mask_);
+    }
+  }
+
+  // calls f on the element of the ticket tail in place and destroys it
+  template <typename F> void visit_(ticket_type const tail, F &&f) noexcept {
+    prefetch_<false>(tail);
+    auto &slot = slots_[idx_(tail)];
+    f(slot.get());
+    slot.destroy();
+    slot.turn.store(turn_(tail) * 2 + 2, std::memory_order_release);
+    wait_type::notify(slot.turn);
+    if (stats_type::enabled) {
+      stats_.sample_tail(tail, sample_mask_);
+    }
+  }
+
+  // with a prefetch policy warms up the slot of the ticket distance after
+  // ticket. bulk operations come through here for every ticket so they stay
+  // the same distance ahead
+  template <bool Write> void prefetch_(ticket_type const ticket) noexcept {
+    if (prefetch_type::enabled) {
+      detail::prefetch<Write>(&slots_[idx_(ticket + prefetch_type::distance)],
+                              sizeof(slot_type));
+    }
+  }
+
+  static size_t sample_mask(const size_t capacity) noexcept {
+    size_t interval = 1;
+    while (interval < 64 && interval * 2 <= capacity / 8) {
+      interval *= 2;
+    }
+    return interval - 1;
+  }
+
+  constexpr size_t idx_(ticket_type i) const noexcept {
+    return mapping_(capacity_.idx(i));
+  }
+
+  constexpr ticket_type turn_(ticket_type i) const noexcept {
+    return capacity_.turn(i);
+  }
+
+private:
+  const capacity_type capacity_;
+  const mapping_type mapping_;
+  const size_t sample_mask_;
+  storage_type slots_;
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+  Allocator allocator_ [[no_unique_address]];
+  stats_type stats_ [[no_unique_address]];
+  notifier_type notifier_ [[no_unique_address]];
+#else
+  Allocator allocator_;
+  stats_type stats_;
+  notifier_type notifier_;
+#endif
+
+  // align to avoid false sharing between head_ and tail_
+  alignas(hardware_interference_size) std::atomic<ticket_type> head_;
+  alignas(hardware_interference_size) std::atomic<ticket_type> tail_;
+
+  // the head at close, no ticket is closed before that
+  std::atomic<ticket_type> closed_head_;
+
+  // items dropped by overwrite_oldest
+  std::atomic<uint64_t> dropped_;
+};
+
+/// static_queue<T, N, Policies...>
+/// a queue with capacity N fixed at compile time and its slots stored inline,
+/// it allocates nothing and the index math folds to constants
+template <typename T, size_t N, typename... Policies>
+using static_queue = queue<T, static_capacity<N>, inline_storage, Policies...>;
+
+/// segmented_queue<T, Policies...>
+/// a queue that grows and shrinks on demand by chaining fixed size ring
+/// segments. tickets are handed out from a global head and tail exactly like
+/// in queue, ticket t lives in segment t / segment_size and each slot follows
+/// the same turn protocol. segment k is found through a directory entry
+/// k % max_segments, it is allocated when the first ticket in it is claimed
+/// and recycled by whichever reader releases its last slot, each segment
+/// counts its slots not yet read so no reader waits for another. recycled
+/// segments go to a free list of at most max_idle segments, beyond that they
+/// are freed as soon as no try operation is looking up a segment, so the
+/// memory in use shrinks again after a burst. at most max_segments * segment_size
+/// elements can be in the queue, beyond that producers block or fail.
+/// allocation failure in a blocking operation terminates the program.
+/// accepts the layout, wait and allocator policies of queue.
+template <typename T, typename... Policies> class segmented_queue {
+private:
+  using layout_type =
+      typename detail::find_policy<detail::layout_tag, padded_slots,
+                                   Policies...>::type;
+  using slot_type = typename layout_type::template slot_type<T>;
+  using mapping_type = typename layout_type::template mapping<T>;
+  using wait_type =
+      typename detail::find_policy<detail::wait_tag, spin_wait,
+                                   Policies...>::type;
+  using Allocator =
+      typename std::allocator_traits<typename detail::find_allocator<
+          aligned_allocator<slot_type>,
+          Policies...>::type>::template rebind_alloc<slot_type>;
+
+  static_assert(std::is_nothrow_copy_assignable<T>::value ||
+                    std::is_nothrow_move_assignable<T>::value,
+                "T must be nothrow copy or move assignable");
+
+  static_assert(std::is_nothrow_destructible<T>::value,
+                "T must be nothrow destructible");
+
+  struct segment {
+    // number of the segment, read by threads looking it up
+    std::atomic<ticket_type> id = {0};
+    // number of times the segment has been used, the turns of its slots
+    // start at 2 * gen
+    std::atomic<ticket_type> gen = {0};
+    // number of slots not yet read in this use, the reader taking it to
+    // zero recycles the segment
+    std::atomic<size_t> unread = {0};
+    slot_type *slots = nullptr;
+    segment *next_free = nullptr;
+  };
+
+  // segment k is kept in entry k % max_segments. an entry holds its
+  // segments in order, next is the number of the segment that is or will be
+  // installed in it and only moves on when that segment is recycled
+  struct entry {
+    std::atomic<segment *> seg;
+    std::atomic<ticket_type> next;
+  };
+
+  // counts the try operations looking up a segment without holding a ticket
+  // in it, segments are only freed while there are none
+  class lookup_guard {
+  public:
+    explicit lookup_guard(std::atomic<size_t> &lookups) noexcept
+        : lookups_(lookups) {
+      lookups_.fetch_add(1, std::memory_order_seq_cst);
+      // pairs with the fence in release_, either the releasing thread sees
+      // the lookup or the lookup sees the segment unlinked
+#if !defined(MPMC_THREAD_SANITIZER)
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+    }
+
+    ~lookup_guard() noexcept {
+      lookups_.fetch_sub(1, std::memory_order_release);
+    }
+
+    lookup_guard(const lookup_guard &) = delete;
+    lookup_guard &operator=(const lookup_guard &) = delete;
+
+  private:
+    std::atomic<size_t> &lookups_;
+  };
+
+public:
+  explicit segmented_queue(const size_t segment_size = 1024,
+                           const size_t max_segments = 4096,
+                           const size_t max_idle = 2,
+                           const Allocator &alloc = Allocator())
+      : segment_(segment_size), directory_(max_segments),
+        mapping_(segment_.capacity()), max_idle_(max_idle), allocator_(alloc),
+        entries_(new entry[directory_.capacity()]), free_(nullptr), idle_(0),
+        lookups_(0), head_(0), tail_(0) {
+    for (size_t i = 0; i < directory_.capacity(); ++i) {
+      entries_[i].seg.store(nullptr, std::memory_order_relaxed);
+      entries_[i].next.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~segmented_queue() noexcept {
+    // every segment is either installed in an entry or on the free list
+    for (size_t i = 0; i < directory_.capacity(); ++i) {
+      auto *seg = entries_[i].seg.load(std::memory_order_relaxed);
+      if (seg != nullptr) {
+        free_segment_(seg);
+      }
+    }
+    free_segments_(free_);
+  }
+
+  // non-copyable and non-movable
+  segmented_queue(const segmented_queue &) = delete;
+  segmented_queue &operator=(const segmented_queue &) = delete;
+
+  template <typename... Args> void emplace(Args &&...args) noexcept {
+    static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
+                  "T must be nothrow constructible with Args&&...");
+    auto const head = head_.fetch_add(1);
+    auto *seg = find_(segment_.turn(head));
+    auto &slot = seg->slots[mapping_(segment_.idx(head))];
+    auto const turn = seg->gen.load(std::memory_order_relaxed) * 2;
+    wait_type::wait(slot.turn, [&slot, turn]() noexcept {
+      return turn == slot.turn.load(std::memory_order_acquire);
+    });
+    publish_(slot, turn, std::forward<Args>(args)...);
+  }
+
+  template <typename... Args> bool try_emplace(Args &&...args) noexcept {
+    static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
+                  "T must be nothrow constructible with Args&&...");
+    ticket_type head;
+    if (!try_claim_head_(head)) {
+      return false;
+    }
+    auto *seg = find_(segment_.turn(head));
+    auto &slot = seg->slots[mapping_(segment_.idx(head))];
+    publish_(slot, seg->gen.load(std::memory_order_relaxed) * 2,
+             std::forward<Args>(args)...);
+    return true;
+  }
+
+  void push(const T &v) noexcept {
+    static_assert(std::is_nothrow_copy_constructible<T>::value,
+                  "T must be nothrow copy constructible");
+    emplace(v);
+  }
+
+  template <typename P,
+            typename = typename std::enable_if<
+                std::is_nothrow_constructible<T, P &&>::value>::type>
+  void push(P &&v) noexcept {
+    emplace(std::forward<P>(v));
+  }
+
+  bool try_push(const T &v) noexcept {
+    static_assert(std::is_nothrow_copy_constructible<T>::value,
+                  "T must be nothrow copy constructible");
+    return try_emplace(v);
+  }
+
+  template <typename P,
+            typename = typename std::enable_if<
+                std::is_nothrow_constructible<T, P &&>::value>::type>
+  bool try_push(P &&v) noexcept {
+    return try_emplace(std::forward<P>(v));
+  }
+
+  void pop(T &v) noexcept {
+    auto const tail = tail_.fetch_add(1);
+    auto *seg = find_(segment_.turn(tail));
+    auto &slot = seg->slots[mapping_(segment_.idx(tail))];
+    auto const turn = seg->gen.load(std::memory_order_relaxed) * 2 + 1;
+    wait_type::wait(slot.turn, [&slot, turn]() noexcept {
+      return turn == slot.turn.load(std::memory_order_acquire);
+    });
+    consume_(seg, tail, v);
+  }
+
+  bool try_pop(T &v) noexcept {
+    ticket_type tail;
+    auto *seg = try_claim_tail_(tail);
+    if (seg == nullptr) {
+      return false;
+    }
+    consume_(seg, tail, v);
+    return true;
+  }
+
+  /// returns the number of elements in the queue.
+  /// the size can be negative when the queue is empty and there is at least one
+  /// reader waiting. since this is a concurrent queue the size is only a best
+  /// effort guess until all reader and writer threads have been joined.
+  ptrdiff_t size() const noexcept {
+    auto const tail = tail_.load(std::memory_order_acquire);
+    auto const head = head_.load(std::memory_order_relaxed);
+    return static_cast<ptrdiff_t>(static_cast<int64_t>(head - tail));
+  }
+
+  /// returns true if the queue is empty.
+  /// since this is a concurrent queue this is only a best effort guess
+  /// until all reader and writer threads have been joined.
+  bool empty() const noexcept { return size() <= 0; }
+
+private:
+  template <typename... Args>
+  void publish_(slot_type &slot, ticket_type const turn,
+                Args &&...args) noexcept {
+    slot.construct(std::forward<Args>(args)...);
+    slot.turn.store(turn + 1, std::memory_order_release);
+    wait_type::notify(slot.turn);
+  }
+
+  // claims the head ticket if its slot is free for writing, the segment
+  // need not be installed yet. returns false if the queue is full
+  bool try_claim_head_(ticket_type &head) noexcept {
+    lookup_guard guard(lookups_);
+    head = head_.load(std::memory_order_acquire);
+    for (;;) {
+      auto const k = segment_.turn(head);
+      auto &e = entries_[directory_.idx(k)];
+      bool ready = false;
+      if (e.next.load(std::memory_order_acquire) == k) {
+        auto *seg = e.seg.load(std::memory_order_acquire);
+        // a missing segment is free, it is installed once the ticket is ours
+        ready = seg == nullptr;
+        if (seg != nullptr && seg->id.load(std::memory_order_acquire) == k) {
+          auto &slot = seg->slots[mapping_(segment_.idx(head))];
+          ready = seg->gen.load(std::memory_order_relaxed) * 2 ==
+                  slot.turn.load(std::memory_order_acquire);
+        }
+      }
+      if (ready) {
+        if (head_.compare_exchange_strong(head, head + 1)) {
+          return true;
+        }
+      } else {
+        auto const prev_head = head;
+        head = head_.load(std::memory_order_acquire);
+        if (head == prev_head) {
+          return false;
+        }
+      }
+    }
+  }
+
+  // claims the tail ticket if its slot has been written and returns its
+  // segment, or nullptr if the queue is empty
+  segment *try_claim_tail_(ticket_type &tail) noexcept {
+    lookup_guard guard(lookups_);
+    tail = tail_.load(std::memory_order_acquire);
+    for (;;) {
+      auto const k = segment_.turn(tail);
+      auto &e = entries_[directory_.idx(k)];
+      auto *seg = e.next.load(std::memory_order_acquire) == k
+                      ? e.seg.load(std::memory_order_acquire)
+                      : nullptr;
+      if (seg != nullptr && seg->id.load(std::memory_order_acquire) == k &&
+          seg->gen.load(std::memory_order_relaxed) * 2 + 1 ==
+              seg->slots[mapping_(segment_.idx(tail))].turn.load(
+                  std::memory_order_acquire)) {
+        // the ticket keeps the segment from being recycled once it is ours
+        if (tail_.compare_exchange_strong(tail, tail + 1)) {
+          return seg;
+        }
+      } else {
+        auto const prev_tail = tail;
+        tail = tail_.load(std::memory_order_acquire);
+        if (tail == prev_tail) {
+          return nullptr;
+        }
+      }
+    }
+  }
+
+  void consume_(segment *seg, ticket_type const tail, T &v) noexcept {
+    auto const turn = seg->gen.load(std::memory_order_relaxed) * 2 + 2;
+    auto &slot = seg->slots[mapping_(segment_.idx(tail))];
+    v = slot.move();
+    slot.destroy();
+    slot.turn.store(turn, std::memory_order_release);
+    wait_type::notify(slot.turn);
+    // the reader releasing the last unread slot recycles the segment, it
+    // sees the turns stored by every other reader of it
+    if (seg->unread.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      recycle_(seg, segment_.turn(tail));
+    }
+  }
+
+  // returns segment k, installing it if it is not there yet. the caller must
+  // hold a ticket in segment k, which keeps it from being recycled
+  segment *find_(ticket_type const k) noexcept {
+    auto &e = entries_[directory_.idx(k)];
+    // wait for segment k - max_segments to be recycled
+    wait_type::wait(e.next, [&e, k]() noexcept {
+      return k == e.next.load(std::memory_order_acquire);
+    });
+    auto *seg = e.seg.load(std::memory_order_acquire);
+    if (seg == nullptr) {
+      auto *fresh = acquire_(k);
+      if (e.seg.compare_exchange_strong(seg, fresh,
+                                        std::memory_order_acq_rel)) {
+        return fresh;
+      }
+      release_(fresh);
+    }
+    return seg;
+  }
+
+  // takes a segment from the free list or allocates a new one
+  segment *acquire_(ticket_type const k) noexcept {
+    segment *seg;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      seg = free_;
+      if (seg != nullptr) {
+        free_ = seg->next_free;
+        --idle_;
+      }
+    }
+    if (seg == nullptr) {
+      seg = new segment();
+      seg->slots = allocator_.allocate(segment_.capacity());
+      if (reinterpret_cast<size_t>(seg->slots) % alignof(slot_type) != 0) {
+        std::terminate();
+      }
+      for (size_t i = 0; i < segment_.capacity(); ++i) {
+        new (&seg->slots[i]) slot_type();
+      }
+    }
+    seg->unread.store(segment_.capacity(), std::memory_order_relaxed);
+    seg->id.store(k, std::memory_order_release);
+    return seg;
+  }
+
+  // returns a segment to the free list and frees the segments beyond
+  // max_idle_ if no try operation may still be looking at them
+  void release_(segment *seg) noexcept {
+    segment *excess = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      seg->next_free = free_;
+      free_ = seg;
+      if (++idle_ <= max_idle_) {
+        return;
+      }
+      // every segment on the free list was unlinked from its entry before
+      // it was put there, pairs with the fence in lookup_guard
+#if defined(MPMC_THREAD_SANITIZER)
+      if (lookups_.fetch_add(0, std::memory_order_seq_cst) != 0) {
+#else
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (lookups_.load(std::memory_order_acquire) != 0) {
+#endif
+        return;
+      }
+      for (; idle_ > max_idle_; --idle_) {
+        auto *next = free_->next_free;
+        free_->next_free = excess;
+        excess = free_;
+        free_ = next;
+      }
+    }
+    free_segments_(excess);
+  }
+
+  void free_segment_(segment *seg) noexcept {
+    if (!std::is_trivially_destructible<slot_type>::value) {
+      for (size_t i = 0; i < segment_.capacity(); ++i) {
+        seg->slots[i].~slot_type();
+      }
+    }
+    allocator_.deallocate(seg->slots, segment_.capacity());
+    delete seg;
+  }
+
+  // frees a list of segments linked through next_free
+  void free_segments_(segment *seg) noexcept {
+    while (seg != nullptr) {
+      auto *next = seg->next_free;
+      free_segment_(seg);
+      seg = next;
+    }
+  }
+
+  void recycle_(segment *seg, ticket_type const k) noexcept {
+    auto &e = entries_[directory_.idx(k)];
+    e.seg.store(nullptr, std::memory_order_release);
+    e.next.store(k + directory_.capacity(), std::memory_order_release);
+    wait_type::notify(e.next);
+    // every slot was read, so the turns are at 2 * (gen + 1)
+    seg->gen.store(seg->gen.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+    release_(seg);
+  }
+
+private:
+  const power_of_two_capacity segment_;
+  const power_of_two_capacity directory_;
+  const mapping_type mapping_;
+  const size_t max_idle_;
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+  Allocator allocator_ [[no_unique_address]];
+#else
+  Allocator allocator_;
+#endif
+  std::unique_ptr<entry[]> entries_;
+  std::mutex mutex_;
+  segment *free_;
+  size_t idle_;
+  // try operations looking up segments, on its own line since every try
+  // operation writes it
+  alignas(hardware_interference_size) std::atomic<size_t> lookups_;
+
+  // align to avoid false sharing between head_ and tail_
+  alignas(hardware_interference_size) std::atomic<ticket_type> head_;
+  alignas(hardware_interference_size) std::atomic<ticket_type> tail_;
+};
+
+/// sharded_queue<T, Policies...>
+/// a front-end holding one queue<T, Policies...> per core group. the cpus
+/// are split into one group of consecutive cpus per shard and operations
+/// without a shard argument use the home shard of the calling thread, the
+/// group of the cpu it first ran on. threads are spread over the shards
+/// round robin instead where the cpu cannot be queried or there are fewer
+/// cpus than shards. consumers pop from their home shard and steal from the
+/// other shards only when it is empty, so ordering is fifo within a shard
+/// but not across shards. the numa node only decides where the memory of a
+/// shard lives: allocators can be made per shard, eg numa_allocator bound to
+/// the node of the cpus of each shard, and each shard queue object is itself
+/// allocated with the allocator of its shard. pop parks with the wait policy of the shards
+/// once every shard is empty and is woken by the pushes of this front-end,
+/// items pushed directly through shard(i) do not wake it. since any thread
+/// may push to or steal from any shard the shards must keep the default
+/// cardinality policies.
+template <typename T, typename... Policies> class sharded_queue {
+  static_assert(
+      std::is_same<typename detail::find_policy<detail::producer_tag,
+                                                multi_producer,
+                                                Policies...>::type,
+                   multi_producer>::value &&
+          std::is_same<typename detail::find_policy<detail::consumer_tag,
+                                                    multi_consumer,
+                                                    Policies...>::type,
+                       multi_consumer>::value,
+      "shards must be multi_producer and multi_consumer");
+
+  using wait_type =
+      typename detail::find_policy<detail::wait_tag, spin_wait,
+                                   Policies...>::type;
+
+public:
+  using queue_type = queue<T, Policies...>;
+  using shard_allocator =
+      typename std::allocator_traits<typename detail::find_allocator<
+          aligned_allocator<T>,
+          Policies...>::type>::template rebind_alloc<queue_type>;
+
+  explicit sharded_queue(const size_t shards, const size_t capacity)
+      : count_(shards), group_(cpu_group(shards)), idle_(0), wake_(0) {
+    init_(capacity, [](size_t) { return shard_allocator(); });
+  }
+
+  /// constructs shard i and its queue object with the allocator returned by
+  /// make_allocator(i)
+  template <typename F>
+  sharded_queue(const size_t shards, const size_t capacity,
+                F &&make_allocator)
+      : count_(shards), group_(cpu_group(shards)), idle_(0), wake_(0) {
+    init_(capacity, std::forward<F>(make_allocator));
+  }
+
+  ~sharded_queue() noexcept { destroy_(); }
+
+  // non-copyable and non-movable
+  sharded_queue(const sharded_queue &) = delete;
+  sharded_queue &operator=(const sharded_queue &) = delete;
+
+  size_t shard_count() const noexcept { return count_; }
+
+  /// returns the shard operations of the calling thread go to
+  size_t home_shard() const noexcept {
+    auto const cpu = detail::thread_cpu();
+    if (group_ == 0 || cpu == detail::no_cpu) {
+      return detail::thread_shard() % count_;
+    }
+    return cpu / group_ % count_;
+  }
+
+  queue_type &shard(const size_t i) noexcept { return *shards_[i].queue; }
+
+  template <typename... Args> void emplace(Args &&...args) noexcept {
+    home_().emplace(std::forward<Args>(args)...);
+    wake_idle_();
+  }
+
+  template <typename... Args> bool try_emplace(Args &&...args) noexcept {
+    if (!home_().try_emplace(std::forward<Args>(args)...)) {
+      return false;
+    }
+    wake_idle_();
+    return true;
+  }
+
+  void push(const T &v) noexcept {
+    home_().push(v);
+    wake_idle_();
+  }
+
+  template <typename P,
+            typename = typename std::enable_if<
+                std::is_nothrow_constructible<T, P &&>::value>::type>
+  void push(P &&v) noexcept {
+    home_().push(std::forward<P>(v));
+    wake_idle_();
+  }
+
+  bool try_push(const T &v) noexcept {
+    if (!home_().try_push(v)) {
+      return false;
+    }
+    wake_idle_();
+    return true;
+  }
+
+  template <typename P,
+            typename = typename std::enable_if<
+                std::is_nothrow_constructible<T, P &&>::value>::type>
+  bool try_push(P &&v) noexcept {
+    if (!home_().try_push(std::forward<P>(v))) {
+      return false;
+    }
+    wake_idle_();
+    return true;
+  }
+
+  /// dequeue an item from the home shard, stealing from the other shards
+  /// while it is empty. blocks with the wait policy until an item is found.
+  void pop(T &v) noexcept {
+    while (!try_pop(v)) {
+      auto const seen = wake_.load(std::memory_order_acquire);
+      idle_.fetch_add(1, std::memory_order_seq_cst);
+      // pairs with the fence in wake_idle_, either the pushing thread sees
+      // the idle consumer or the idle consumer sees the item
+#if !defined(MPMC_THREAD_SANITIZER)
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+      auto const found = try_pop(v);
+      if (!found) {
+        wait_type::wait(wake_, [this, seen]() noexcept {
+          return wake_.load(std::memory_order_acquire) != seen;
+        });
+      }
+      idle_.fetch_sub(1, std::memory_order_relaxed);
+      if (found) {
+        return;
+      }
+    }
+  }
+
+  /// try to dequeue an item from the home shard and then from the other
+  /// shards in turn. returns false if every shard was empty.
+  bool try_pop(T &v) noexcept { return try_pop(home_shard(), v); }
+
+  /// try to dequeue an item starting from shard home.
+  bool try_pop(const size_t home, T &v) noexcept {
+    for (size_t i = 0; i < count_; ++i) {
+      if (shards_[(home + i) % count_].queue->try_pop(v)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// returns the sum of the sizes of the shards, a best effort guess like
+  /// queue::size.
+  ptrdiff_t size() const noexcept {
+    ptrdiff_t n = 0;
+    for (size_t i = 0; i < count_; ++i) {
+      n += shards_[i].queue->size();
+    }
+    return n;
+  }
+
+  bool empty() const noexcept { return size() <= 0; }
+
+private:
+  struct shard_slot {
+    shard_allocator allocator;
+    queue_type *queue;
+  };
+
+  template <typename Make> void init_(const size_t capacity, Make &&make) {
+    if (count_ < 1) {
+      throw std::invalid_argument("shards < 1");
+    }
+    shards_.reserve(count_);
+    try {
+      for (size_t i = 0; i < count_; ++i) {
+        auto const alloc = make(i);
+        shard_slot s = {shard_allocator(alloc), nullptr};
+        s.queue = s.allocator.allocate(1);
+        // see heap_storage, allocators may not honor over-alignment
+        if (reinterpret_cast<size_t>(s.queue) % alignof(queue_type) != 0) {
+          s.allocator.deallocate(s.queue, 1);
+          throw std::bad_alloc();
+        }
+        try {
+          new (s.queue) queue_type(capacity, alloc);
+        } catch (...) {
+          s.allocator.deallocate(s.queue, 1);
+          throw;
+        }
+        shards_.push_back(s);
+      }
+    } catch (...) {
+      destroy_();
+      throw;
+    }
+  }
+
+  void destroy_() noexcept {
+    for (auto &s : shards_) {
+      s.queue->~queue_type();
+      s.allocator.deallocate(s.queue, 1);
+    }
+  }
+
+  queue_type &home_() noexcept { return *shards_[home_shard()].queue; }
+
+  // number of consecutive cpus sharing a shard, 0 when there are fewer cpus
+  // than shards and threads are spread round robin
+  static size_t cpu_group(const size_t shards) noexcept {
+    auto const cpus = static_cast<size_t>(std::thread::hardware_concurrency());
+    if (shards == 0 || cpus < shards) {
+      return 0;
+    }
+    return (cpus + shards - 1) / shards;
+  }
+
+  void wake_idle_() noexcept {
+#if defined(MPMC_THREAD_SANITIZER)
+    if (idle_.fetch_add(0, std::memory_order_seq_cst) != 0) {
+#else
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (idle_.load(std::memory_order_relaxed) != 0) {
+#endif
+      wake_.fetch_add(1, std::memory_order_release);
+      wait_type::notify(wake_);
+    }
+  }
+
+  const size_t count_;
+  const size_t group_;
+  std::vector<shard_slot> shards_;
+
+  // idle_ counts the consumers about to park in pop, wake_ is bumped to
+  // wake them and only written while some consumer is idle
+  alignas(hardware_interference_size) std::atomic<size_t> idle_;
+  std::atomic<ticket_type> wake_;
+};
+
+namespace detail {
+// index of the lowest set bit of a non-zero word
+inline unsigned countr_zero(const uint64_t x) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+  return static_cast<unsigned>(__builtin_ctzll(x));
+#else
+  unsigned n = 0;
+  while (((x >> n) & 1) == 0) {
+    ++n;
+  }
+  return n;
+#endif
+}
+
+// position of the calling thread in weighted round robin schedules
+inline size_t &thread_cursor() noexcept {
+  static thread_local size_t cursor = 0;
+  return cursor;
+}
+} // namespace detail
+
+/// priority_queue<T, Levels, Policies...>
+/// a queue with Levels lanes, each a queue<T, Policies...>, where lane 0 has
+/// the highest priority. a summary word has bit i set while lane i may hold
+/// items so that consumers find a non-empty lane in O(1) without scanning
+/// empty lanes. producers only write the summary when their lane was marked
+/// empty, in the steady state they pay a single load of it. by default
+/// consumers take the highest priority non-empty lane. constructed with
+/// weights, consumers instead follow a weighted round robin over the lanes,
+/// each lane getting weight[i] turns per round, skipping empty lanes. the
+/// schedule position is kept per consumer thread. items are fifo within a
+/// lane. pop parks with the wait policy of the lanes once every lane is
+/// empty and is woken by the pushes of this front-end, items pushed directly
+/// through lane(i) do not wake it. lanes must keep the default cardinality
+/// and ordering policies.
+template <typename T, size_t Levels, typename... Policies>
+class priority_queue {
+  static_assert(Levels >= 1 && Levels <= 64, "Levels must be in [1, 64]");
+  static_assert(
+      std::is_same<typename detail::find_policy<detail::producer_tag,
+                                                multi_producer,
+                                                Policies...>::type,
+                   multi_producer>::value &&
+          std::is_same<typename detail::find_policy<detail::consumer_tag,
+                                                    multi_consumer,
+                                                    Policies...>::type,
+                       multi_consumer>::value,
+      "lanes must be multi_producer and multi_consumer");
+  // the summary protocol relies on the ticket claim being sequentially
+  // consistent
+  static_assert(
+      std::is_same<typename detail::find_policy<detail::ordering_tag,
+                                                seq_cst_ordering,
+                                                Policies...>::type,
+                   seq_cst_ordering>::value,
+      "lanes must use seq_cst_ordering");
+
+  using wait_type =
+      typename detail::find_policy<detail::wait_tag, spin_wait,
+                                   Policies...>::type;
+
+public:
+  using queue_type = queue<T, Policies...>;
+
+  /// constructs a strict priority queue with capacity items per lane
+  explicit priority_queue(const size_t capacity) : lanes_(nullptr) {
+    init_(capacity);
+  }
+
+  /// constructs a weighted round robin queue, lane i gets weights[i] turns
+  /// in every round
+  priority_queue(const size_t capacity, std::initializer_list<size_t> weights)
+      : lanes_(nullptr) {
+    if (weights.size() != Levels) {
+      throw std::invalid_argument("weights.size() != Levels");
+    }
+    size_t level = 0;
+    for (auto w : weights) {
+      for (size_t i = 0; i < w; ++i) {
+        schedule_.push_back(static_cast<uint8_t>(level));
+      }
+      ++level;
+    }
+    if (schedule_.empty()) {
+      throw std::invalid_argument("weights are all zero");
+    }
+    init_(capacity);
+  }
+
+  ~priority_queue() noexcept { destroy_(Levels); }
+
+  // non-copyable and non-movable
+  priority_queue(const priority_queue &) = delete;
+  priority_queue &operator=(const priority_queue &) = delete;
+
+  queue_type &lane(const size_t level) noexcept {
+    assert(level < Levels);
+    return lanes_[level];
+  }
+
+  template <typename... Args>
+  void emplace(const size_t level, Args &&...args) noexcept {
+    lane(level).emplace(std::forward<Args>(args)...);
+    mark_(level);
+    wake_idle_();
+  }
+
+  template <typename... Args>
+  bool try_emplace(const size_t level, Args &&...args) noexcept {
+    if (!lane(level).try_emplace(std::forward<Args>(args)...)) {
+      return false;
+    }
+    mark_(level);
+    wake_idle_();
+    return true;
+  }
+
+  void push(const size_t level, const T &v) noexcept { emplace(level, v); }
+
+  template <typename P,
+            typename = typename std::enable_if<
+                std::is_nothrow_constructible<T, P &&>::value>::type>
+  void push(const size_t level, P &&v) noexcept {
+    emplace(level, std::forward<P>(v));
+  }
+
+  bool try_push(const size_t level, const T &v) noexcept {
+    return try_emplace(level, v);
+  }
+
+  template <typename P,
+            typename = typename std::enable_if<
+                std::is_nothrow_constructible<T, P &&>::value>::type>
+  bool try_push(const size_t level, P &&v) noexcept {
+    return try_emplace(level, std::forward<P>(v));
+  }
+
+  /// dequeue an item from the lane picked by the schedule, blocks with the
+  /// wait policy until an item is found.
+  void pop(T &v) noexcept {
+    while (!try_pop(v)) {
+      auto const seen = wake_.load(std::memory_order_acquire);
+      idle_.fetch_add(1, std::memory_order_seq_cst);
+      // pairs with the fence in wake_idle_, either the pushing thread sees
+      // the idle consumer or the idle consumer sees the item
+#if !defined(MPMC_THREAD_SANITIZER)
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+      auto const found = try_pop(v);
+      if (!found) {
+        wait_type::wait(wake_, [this, seen]() noexcept {
+          return wake_.load(std::memory_order_acquire) != seen;
+        });
+      }
+      idle_.fetch_sub(1, std::memory_order_relaxed);
+      if (found) {
+        return;
+      }
+    }
+  }
+
+  /// try to dequeue an item from the lane picked by the schedule. returns
+  /// false if every lane is empty.
+  bool try_pop(T &v) noexcept {
+    auto const start = next_();
+    // lanes found empty by this call, they may stay marked while a producer
+    // is writing to them
+    uint64_t empty = 0;
+    for (;;) {
+      auto const mask = summary_.load(std::memory_order_acquire) & ~empty;
+      if (mask == 0) {
+        return false;
+      }
+      // the first marked lane at or after start, wrapping around
+      auto const after = mask & (~uint64_t(0) << start);
+      auto const level = detail::countr_zero(after != 0 ? after : mask);
+      if (lanes_[level].try_pop(v)) {
+        return true;
+      }
+      empty |= uint64_t(1) << level;
+      unmark_(level);
+    }
+  }
+
+  /// returns the number of items in all lanes, a best effort guess like
+  /// queue::size.
+  ptrdiff_t size() const noexcept {
+    ptrdiff_t n = 0;
+    for (size_t i = 0; i < Levels; ++i) {
+      n += lanes_[i].size();
+    }
+    return n;
+  }
+
+  bool empty() const noexcept { return size() <= 0; }
+
+private:
+  void init_(const size_t capacity) {
+    lanes_ = allocator_.allocate(Levels);
+    size_t i = 0;
+    try {
+      for (; i < Levels; ++i) {
+        new (&lanes_[i]) queue_type(capacity);
+      }
+    } catch (...) {
+      destroy_(i);
+      throw;
+    }
+  }
+
+  void destroy_(const size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i) {
+      lanes_[i].~queue_type();
+    }
+    allocator_.deallocate(lanes_, Levels);
+  }
+
+  // the level consumers start looking from, 0 unless weighted
+  unsigned next_() noexcept {
+    if (schedule_.empty()) {
+      return 0;
+    }
+    auto &cursor = detail::thread_cursor();
+    return schedule_[cursor++ % schedule_.size()];
+  }
+
+  // called after pushing to level. the load is ordered after the ticket was
+  // claimed so that either we see the lane unmarked and mark it, or the
+  // consumer unmarking it sees our ticket and marks it again
+  void mark_(const size_t level) noexcept {
+    auto const bit = uint64_t(1) << level;
+    if ((summary_.load(std::memory_order_seq_cst) & bit) == 0) {
+      summary_.fetch_or(bit);
+    }
+  }
+
+  // called after level was found empty, marks it again if a producer
+  // claimed a ticket in the meantime
+  void unmark_(const size_t level) noexcept {
+    auto const bit = uint64_t(1) << level;
+    summary_.fetch_and(~bit);
+#if !defined(MPMC_THREAD_SANITIZER)
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+    if (!lanes_[level].empty()) {
+      summary_.fetch_or(bit);
+    }
+  }
+
+  void wake_idle_() noexcept {
+#if defined(MPMC_THREAD_SANITIZER)
+    if (idle_.fetch_add(0, std::memory_order_seq_cst) != 0) {
+#else
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (idle_.load(std::memory_order_relaxed) != 0) {
+#endif
+      wake_.fetch_add(1, std::memory_order_release);
+      wait_type::notify(wake_);
+    }
+  }
+
+  aligned_allocator<queue_type> allocator_;
+  queue_type *lanes_;
+  std::vector<uint8_t> schedule_;
+
+  // align to avoid false sharing with the fields above
+  alignas(hardware_interference_size) std::atomic<uint64_t> summary_ = {0};
+
+  // idle_ counts the consumers about to park in pop, wake_ is bumped to
+  // wake them and only written while some consumer is idle
+  alignas(hardware_interference_size) std::atomic<size_t> idle_ = {0};
+  std::atomic<ticket_type> wake_ = {0};
+};
+
+/// broadcast_queue<T, Policies...>
+/// a ring where every item is seen by each of a fixed number of
+/// subscribers, disruptor style. producers claim tickets from the head like
+/// in queue and write each item once into a slot<T>, subscribers read it in
+/// place through their own cursor, the next ticket they read. a producer
+/// reuses a slot only once the slowest subscriber has passed the item in
+/// it, which it learns from a cached gating cursor, the minimum of the
+/// subscriber cursors, and destroys the item before writing its own. the
+/// turn of a slot is 2 * lap + 1 while it holds the item of lap. each
+/// subscriber must be driven by one thread at a time. accepts the capacity,
+/// layout, wait and allocator policies of queue.
+template <typename T, typename... Policies> class broadcast_queue {
+private:
+  using capacity_type =
+      typename detail::find_policy<detail::capacity_tag, dynamic_capacity,
+                                   Policies...>::type;
+  using layout_type =
+      typename detail::find_policy<detail::layout_tag, padded_slots,
+                                   Policies...>::type;
+  using slot_type = typename layout_type::template slot_type<T>;
+  using mapping_type = typename layout_type::template mapping<T>;
+  using wait_type =
+      typename detail::find_policy<detail::wait_tag, spin_wait,
+                                   Policies...>::type;
+  using Allocator =
+      typename std::allocator_traits<typename detail::find_allocator<
+          aligned_allocator<slot_type>,
+          Policies...>::type>::template rebind_alloc<slot_type>;
+
+  static_assert(std::is_nothrow_destructible<T>::value,
+                "T must be nothrow destructible");
+
+public:
+  broadcast_queue(const size_t capacity, const size_t subscribers,
+                  const Allocator &alloc = Allocator())
+      : capacity_(capacity), mapping_(capacity_.capacity()),
+        subscribers_(subscribers), allocator_(alloc), head_(0), gating_(0) {
+    if (subscribers_ < 1) {
+      throw std::invalid_argument("subscribers < 1");
+    }
+    slots_ = allocator_.allocate(capacity_.capacity() + 1);
+    if (reinterpret_cast<size_t>(slots_) % alignof(slot_type) != 0) {
+      allocator_.deallocate(slots_, capacity_.capacity() + 1);
+      throw std::bad_alloc();
+    }
+    try {
+      cursors_ = cursor_allocator_.allocate(subscribers_);
+    } catch (...) {
+      allocator_.deallocate(slots_, capacity_.capacity() + 1);
+      throw;
+    }
+    for (size_t i = 0; i < capacity_.capacity(); ++i) {
+      new (&slots_[i]) slot_type();
+    }
+    for (size_t i = 0; i < subscribers_; ++i) {
+      new (&cursors_[i]) cursor();
+    }
+  }
+
+  ~broadcast_queue() noexcept {
+    // slots with an odd turn still hold an item
+    if (!std::is_trivially_destructible<slot_type>::value) {
+      for (size_t i = 0; i < capacity_.capacity(); ++i) {
+        slots_[i].~slot_type();
+      }
+    }
+    allocator_.deallocate(slots_, capacity_.capacity() + 1);
+    cursor_allocator_.deallocate(cursors_, subscribers_);
+  }
+
+  // non-copyable and non-movable
+  broadcast_queue(const broadcast_queue &) = delete;
+  broadcast_queue &operator=(const broadcast_queue &) = delete;
+
+  size_t capacity() const noexcept { return capacity_.capacity(); }
+
+  size_t subscriber_count() const noexcept { return subscribers_; }
+
+  /// enqueue an item for every subscriber, blocks until the slowest one
+  /// has passed the item in its slot.
+  template <typename... Args> void emplace(Args &&...args) noexcept {
+    static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
+                  "T must be nothrow constructible with Args&&...");
+    auto const head = head_.fetch_add(1);
+    wait_gate_(head);
+    auto &slot = slots_[idx_(head)];
+    auto const want = free_turn_(head);
+    wait_type::wait(slot.turn, [&slot, want]() noexcept {
+      return slot.turn.load(std::memory_order_acquire) == want;
+    });
+    publish_(head, std::forward<Args>(args)...);
+  }
+
+  /// try to enqueue an item, returns false if the slowest subscriber has not
+  /// passed the item in the slot of the head.
+  template <typename... Args> bool try_emplace(Args &&...args) noexcept {
+    static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
+                  "T must be nothrow constructible with Args&&...");
+    auto head = head_.load(std::memory_order_acquire);
+    for (;;) {
+      auto &slot = slots_[idx_(head)];
+      if (passed_(head) &&
+          slot.turn.load(std::memory_order_acquire) == free_turn_(head)) {
+        if (head_.compare_exchange_strong(head, head + 1)) {
+          publish_(head, std::forward<Args>(args)...);
+          return true;
+        }
+      } else {
+        auto const prev_head = head;
+        head = head_.load(std::memory_order_acquire);
+        if (head == prev_head) {
+          return false;
+        }
+      }
+    }
+  }
+
+  void push(const T &v) noexcept {
+    static_assert(std::is_nothrow_copy_constructible<T>::value,
+                  "T must be nothrow copy constructible");
+    emplace(v);
+  }
+
+  template <typename P,
+            typename = typename std::enable_if<
+                std::is_nothrow_constructible<T, P &&>::value>::type>
+  void push(P &&v) noexcept {
+    emplace(std::forward<P>(v));
+  }
+
+  bool try_push(const T &v) noexcept {
+    static_assert(std::is_nothrow_copy_constructible<T>::value,
+                  "T must be nothrow copy constructible");
+    return try_emplace(v);
+  }
+
+  template <typename P,
+            typename = typename std::enable_if<
+                std::is_nothrow_constructible<T, P &&>::value>::type>
+  bool try_push(P &&v) noexcept {
+    return try_emplace(std::forward<P>(v));
+  }
+
+  /// calls f(const T &) in place on the next item of the subscriber, blocks
+  /// until it has been published. f must not throw.
+  template <typename F> void consume(const size_t subscriber, F &&f) noexcept {
+    auto &c = cursors_[subscriber].next;
+    auto const tail = c.load(std::memory_order_relaxed);
+    auto &slot = slots_[idx_(tail)];
+    auto const turn = turn_(tail) * 2 + 1;
+    wait_type::wait(slot.turn, [&slot, turn]() noexcept {
+      return slot.turn.load(std::memory_order_acquire) == turn;
+    });
+    advance_(c, tail, std::forward<F>(f));
+  }
+
+  /// try to call f(const T &) on the next item of the subscriber, returns
+  /// false if it has not been published yet.
+  template <typename F>
+  bool try_consume(const size_t subscriber, F &&f) noexcept {
+    auto &c = cursors_[subscriber].next;
+    auto const tail = c.load(std::memory_order_relaxed);
+    if (slots_[idx_(tail)].turn.load(std::memory_order_acquire) !=
+        turn_(tail) * 2 + 1) {
+      return false;
+    }
+    advance_(c, tail, std::forward<F>(f));
+    return true;
+  }
+
+  /// copies the next item of the subscriber into v, blocks until it has
+  /// been published.
+  void pop(const size_t subscriber, T &v) noexcept {
+    consume(subscriber, [&v](const T &item) noexcept { v = item; });
+  }
+
+  bool try_pop(const size_t subscriber, T &v) noexcept {
+    return try_consume(subscriber,
+                       [&v](const T &item) noexcept { v = item; });
+  }
+
+  /// returns the number of items the subscriber has not read yet, a best
+  /// effort guess like queue::size.
+  ptrdiff_t size(const size_t subscriber) const noexcept {
+    auto const tail =
+        cursors_[subscriber].next.load(std::memory_order_acquire);
+    auto const head = head_.load(std::memory_order_relaxed);
+    return static_cast<ptrdiff_t>(static_cast<int64_t>(head - tail));
+  }
+
+  bool empty(const size_t subscriber) const noexcept {
+    return size(subscriber) <= 0;
+  }
+
+private:
+  struct alignas(hardware_interference_size) cursor {
+    std::atomic<ticket_type> next = {0};
+  };
+
+  // turn in which the slot of ticket head can be written, each lap waits for
+  // the item of the previous one
+  ticket_type free_turn_(ticket_type const head) const noexcept {
+    auto const lap = turn_(head);
+    return lap == 0 ? 0 : lap * 2 - 1;
+  }
+
+  // returns true if every subscriber has passed the previous item in the
+  // slot of ticket head
+  bool passed_(ticket_type const head) noexcept {
+    auto const capacity = static_cast<ticket_type>(capacity_.capacity());
+    if (head < capacity) {
+      return true;
+    }
+    auto const need = head - capacity + 1;
+    auto gating = gating_.load(std::memory_order_acquire);
+    if (gating >= need) {
+      return true;
+    }
+    auto low = std::numeric_limits<ticket_type>::max();
+    for (size_t i = 0; i < subscribers_; ++i) {
+      low = std::min(low, cursors_[i].next.load(std::memory_order_acquire));
+    }
+    raise_gating_(gating, low);
+    return low >= need;
+  }
+
+  // waits until every subscriber has passed the previous item in the slot
+  // of ticket head
+  void wait_gate_(ticket_type const head) noexcept {
+    auto const capacity = static_cast<ticket_type>(capacity_.capacity());
+    if (head < capacity) {
+      return;
+    }
+    auto const need = head - capacity + 1;
+    auto gating = gating_.load(std::memory_order_acquire);
+    if (gating >= need) {
+      return;
+    }
+    for (size_t i = 0; i < subscribers_; ++i) {
+      auto &c = cursors_[i].next;
+      wait_type::wait(c, [&c, need]() noexcept {
+        return c.load(std::memory_order_acquire) >= need;
+      });
+    }
+    raise_gating_(gating, need);
+  }
+
+  // the minimum of the cursors only grows, racing producers keep the larger
+  // of their views
+  void raise_gating_(ticket_type gating, ticket_type const low) noexcept {
+    while (gating < low && !gating_.compare_exchange_weak(
+                               gating, low, std::memory_order_acq_rel,
+                               std::memory_order_acquire)) {
+    }
+  }
+
+  // destroys the item of the previous lap, the subscribers have all passed
+  // it, and writes the item of ticket head
+  template <typename... Args>
+  void publish_(ticket_type const head, Args &&...args) noexcept {
+    auto &slot = slots_[idx_(head)];
+    if (turn_(head) != 0) {
+      slot.destroy();
+    }
+    slot.construct(std::forward<Args>(args)...);
+    slot.turn.store(turn_(head) * 2 + 1, std::memory_order_release);
+    wait_type::notify(slot.turn);
+  }
+
+  template <typename F>
+  void advance_(std::atomic<ticket_type> &c, ticket_type const tail,
+                F &&f) noexcept {
+    auto &slot = slots_[idx_(tail)];
+    f(static_cast<const T &>(slot.get()));
+    c.store(tail + 1, std::memory_order_release);
+    wait_type::notify(c);
+  }
+
+  constexpr size_t idx_(ticket_type i) const noexcept {
+    return mapping_(capacity_.idx(i));
+  }
+
+  constexpr ticket_type turn_(ticket_type i) const noexcept {
+    return capacity_.turn(i);
+  }
+
+  const capacity_type capacity_;
+  const mapping_type mapping_;
+  const size_t subscribers_;
+  slot_type *slots_;
+  cursor *cursors_;
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+  Allocator allocator_ [[no_unique_address]];
+  aligned_allocator<cursor> cursor_allocator_ [[no_unique_address]];
+#else
+  Allocator allocator_;
+  aligned_allocator<cursor> cursor_allocator_;
+#endif
+
+  // align to avoid false sharing between the head and the gating cursor
+  alignas(hardware_interference_size) std::atomic<ticket_type> head_;
+  alignas(hardware_interference_size) std::atomic<ticket_type> gating_;
+};
+
+/// byte_ring<Policies...>
+/// a ring of bytes for variable length messages, like serialized payloads.
+/// the ring is cut into granules of hardware_interference_size bytes that
+/// take the place of slots, a message of n bytes claims the tickets of
+/// max(1, ceil(n / granule)) consecutive granules with one compare and swap
+/// on the head and each granule follows the turn protocol of queue. the
+/// turn and size of a granule live in a separate array so that messages are
+/// contiguous and start on a granule boundary. a message that would run past
+/// the end of the ring is preceded by a padding record up to the end, which
+/// consumers skip. producers reserve, write in place and commit, consumers
+/// read in place and release, every reserved record must be committed and
+/// every read record released. accepts the capacity, wait and allocator
+/// policies of queue, the capacity counts granules.
+template <typename... Policies> class byte_ring {
+private:
+  static constexpr size_t granule = hardware_interference_size;
+
+  struct alignas(granule) block {
+    char bytes[granule];
+  };
+
+  // turn and size of a granule, the size is only set on the first granule
+  // of a record
+  struct meta {
+    std::atomic<ticket_type> turn = {0};
+    std::atomic<uint64_t> size = {0};
+  };
+
+  using capacity_type =
+      typename detail::find_policy<detail::capacity_tag, dynamic_capacity,
+                                   Policies...>::type;
+  using wait_type =
+      typename detail::find_policy<detail::wait_tag, spin_wait,
+                                   Policies...>::type;
+  using Allocator =
+      typename std::allocator_traits<typename detail::find_allocator<
+          aligned_allocator<block>,
+          Policies...>::type>::template rebind_alloc<block>;
+
+  // marks the size of a padding record, the low bits count its granules
+  static constexpr uint64_t padding = uint64_t(1) << 63;
+
+public:
+  /// a reserved or read message, empty if the operation failed
+  class record {
+  public:
+    record() noexcept : data_(nullptr), size_(0), ticket_(0) {}
+
+    char *data() const noexcept { return data_; }
+    size_t size() const noexcept { return size_; }
+    explicit operator bool() const noexcept { return data_ != nullptr; }
+
+  private:
+    friend class byte_ring;
+
+    record(char *data, size_t size, ticket_type ticket) noexcept
+        : data_(data), size_(size), ticket_(ticket) {}
+
+    char *data_;
+    size_t size_;
+    ticket_type ticket_;
+  };
+
+  /// constructs a ring of at least bytes bytes, rounded up to whole granules
+  explicit byte_ring(const size_t bytes, const Allocator &alloc = Allocator())
+      : capacity_((bytes + granule - 1) / granule), allocator_(alloc),
+        head_(0), tail_(0) {
+    blocks_ = allocator_.allocate(capacity_.capacity());
+    if (reinterpret_cast<size_t>(blocks_) % alignof(block) != 0) {
+      allocator_.deallocate(blocks_, capacity_.capacity());
+      throw std::bad_alloc();
+    }
+    try {
+      meta_ = meta_allocator_.allocate(capacity_.capacity());
+    } catch (...) {
+      allocator_.deallocate(blocks_, capacity_.capacity());
+      throw;
+    }
+    for (size_t i = 0; i < capacity_.capacity(); ++i) {
+      new (&meta_[i]) meta();
+    }
+  }
+
+  ~byte_ring() noexcept {
+    meta_allocator_.deallocate(meta_, capacity_.capacity());
+    allocator_.deallocate(blocks_, capacity_.capacity());
+  }
+
+  // non-copyable and non-movable
+  byte_ring(const byte_ring &) = delete;
+  byte_ring &operator=(const byte_ring &) = delete;
+
+  /// returns the size of the ring in bytes, the largest message it fits
+  size_t max_size() const noexcept { return capacity_.capacity() * granule; }
+
+  /// reserves n contiguous bytes, blocks until they are free. returns an
+  /// empty record if n is larger than max_size.
+  record reserve(const size_t n) noexcept {
+    if (n > max_size()) {
+      return record();
+    }
+    auto const count = granules_(n);
+    for (;;) {
+      auto head = head_.load(std::memory_order_acquire);
+      auto const pad = padding_(head, count);
+      if (!head_.compare_exchange_weak(head, head + (pad ? pad : count))) {
+        continue;
+      }
+      wait_free_(head, pad ? pad : count);
+      if (pad) {
+        publish_(head, padding | pad);
+        continue;
+      }
+      return record(data_(head), n, head);
+    }
+  }
+
+  /// tries to reserve n contiguous bytes, returns an empty record if they
+  /// are not free or n is larger than max_size.
+  record try_reserve(const size_t n) noexcept {
+    if (n > max_size()) {
+      return record();
+    }
+    auto const count = granules_(n);
+    auto head = head_.load(std::memory_order_acquire);
+    for (;;) {
+      auto const pad = padding_(head, count);
+      if (free_(head, pad ? pad : count)) {
+        if (head_.compare_exchange_strong(head, head + (pad ? pad : count))) {
+          if (!pad) {
+            return record(data_(head), n, head);
+          }
+          publish_(head, padding | pad);
+          head += pad;
+        }
+      } else {
+        auto const prev_head = head;
+        head = head_.load(std::memory_order_acquire);
+        if (head == prev_head) {
+          return record();
+        }
+      }
+    }
+  }
+
+  /// publishes a reserved record to consumers
+  void commit(const record &r) noexcept { publish_(r.ticket_, r.size_); }
+
+  /// reads the next record in place, blocks until one has been committed
+  record read() noexcept {
+    for (;;) {
+      auto tail = tail_.load(std::memory_order_acquire);
+      auto &m = meta_[idx_(tail)];
+      auto const turn = turn_(tail) * 2 + 1;
+      wait_type::wait(m.turn, [this, &m, turn, tail]() noexcept {
+        return m.turn.load(std::memory_order_acquire) == turn ||
+               tail_.load(std::memory_order_relaxed) != tail;
+      });
+      if (m.turn.load(std::memory_order_acquire) != turn) {
+        continue;
+      }
+      record r;
+      if (claim_(tail, r)) {
+        return r;
+      }
+    }
+  }
+
+  /// tries to read the next record in place, returns an empty record if
+  /// none has been committed
+  record try_read() noexcept {
+    auto tail = tail_.load(std::memory_order_acquire);
+    for (;;) {
+      if (meta_[idx_(tail)].turn.load(std::memory_order_acquire) ==
+          turn_(tail) * 2 + 1) {
+        record r;
+        if (claim_(tail, r)) {
+          return r;
+        }
+        tail = tail_.load(std::memory_order_acquire);
+      } else {
+        auto const prev_tail = tail;
+        tail = tail_.load(std::memory_order_acquire);
+        if (tail == prev_tail) {
+          return record();
+        }
+      }
+    }
+  }
+
+  /// hands the bytes of a read record back to producers
+  void release(const record &r) noexcept {
+    free_granules_(r.ticket_, granules_(r.size_));
+  }
+
+  /// copies n bytes from p into the ring, blocks until they fit. returns
+  /// false if n is larger than max_size.
+  bool push(const void *p, const size_t n) noexcept {
+    auto r = reserve(n);
+    if (!r) {
+      return false;
+    }
+    std::memcpy(r.data(), p, n);
+    commit(r);
+    return true;
+  }
+
+  bool try_push(const void *p, const size_t n) noexcept {
+    auto r = try_reserve(n);
+    if (!r) {
+      return false;
+    }
+    std::memcpy(r.data(), p, n);
+    commit(r);
+    return true;
+  }
+
+  /// calls f(const char *data, size_t size) on the next record in place and
+  /// releases it, blocks until one has been committed. f must not throw.
+  template <typename F> void consume(F &&f) noexcept {
+    auto const r = read();
+    f(static_cast<const char *>(r.data()), r.size());
+    release(r);
+  }
+
+  template <typename F> bool try_consume(F &&f) noexcept {
+    auto const r = try_read();
+    if (!r) {
+      return false;
+    }
+    f(static_cast<const char *>(r.data()), r.size());
+    release(r);
+    return true;
+  }
+
+  /// returns true if no record is waiting to be read, a best effort guess
+  bool empty() const noexcept {
+    return tail_.load(std::memory_order_acquire) >=
+           head_.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr size_t granules_(size_t n) noexcept {
+    return n == 0 ? 1 : (n + granule - 1) / granule;
+  }
+
+  // granules left before the end of the ring if a record of count granules
+  // at ticket head would run past it, zero otherwise
+  size_t padding_(ticket_type const head, size_t const count) const noexcept {
+    auto const left = capacity_.capacity() - capacity_.idx(head);
+    return count > left ? left : 0;
+  }
+
+  bool free_(ticket_type const head, size_t const count) const noexcept {
+    for (size_t i = 0; i < count; ++i) {
+      if (meta_[idx_(head + i)].turn.load(std::memory_order_acquire) !=
+          turn_(head + i) * 2) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void wait_free_(ticket_type const head, size_t const count) noexcept {
+    for (size_t i = 0; i < count; ++i) {
+      auto &m = meta_[idx_(head + i)];
+      auto const turn = turn_(head + i) * 2;
+      wait_type::wait(m.turn, [&m, turn]() noexcept {
+        return m.turn.load(std::memory_order_acquire) == turn;
+      });
+    }
+  }
+
+  // sets the size of the record at ticket head and makes it readable, the
+  // other granules of the record keep their free turn until it is released
+  void publish_(ticket_type const head, uint64_t const size) noexcept {
+    auto &m = meta_[idx_(head)];
+    m.size.store(size, std::memory_order_relaxed);
+    m.turn.store(turn_(head) * 2 + 1, std::memory_order_release);
+    wait_type::notify(m.turn);
+  }
+
+  // claims the readable record at ticket tail, padding records are released
+  // and skipped. returns false if another consumer got there first
+  bool claim_(ticket_type &tail, record &r) noexcept {
+    for (;;) {
+      auto const size = meta_[idx_(tail)].size.load(std::memory_order_relaxed);
+      auto const count = size & padding
+                             ? static_cast<size_t>(size & ~padding)
+                             : granules_(static_cast<size_t>(size));
+      if (!tail_.compare_exchange_strong(tail, tail + count)) {
+        return false;
+      }
+      if (!(size & padding)) {
+        r = record(data_(tail), static_cast<size_t>(size), tail);
+        return true;
+      }
+      free_granules_(tail, count);
+      tail += count;
+      if (meta_[idx_(tail)].turn.load(std::memory_order_acquire) !=
+          turn_(tail) * 2 + 1) {
+        return false;
+      }
+    }
+  }
+
+  // a record never wraps so its granules share a lap
+  void free_granules_(ticket_type const tail, size_t const count) noexcept {
+    auto const turn = turn_(tail) * 2 + 2;
+    for (size_t i = 0; i < count; ++i) {
+      auto &m = meta_[idx_(tail + i)];
+      m.turn.store(turn, std::memory_order_release);
+      wait_type::notify(m.turn);
+    }
+  }
+
+  char *data_(ticket_type const head) const noexcept {
+    return blocks_[idx_(head)].bytes;
+  }
+
+  size_t idx_(ticket_type i) const noexcept { return capacity_.idx(i); }
+
+  ticket_type turn_(ticket_type i) const noexcept { return capacity_.turn(i); }
+
+  const capacity_type capacity_;
+  block *blocks_;
+  meta *meta_;
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+  Allocator allocator_ [[no_unique_address]];
+  aligned_allocator<meta> meta_allocator_ [[no_unique_address]];
+#else
+  Allocator allocator_;
+  aligned_allocator<meta> meta_allocator_;
+#endif
+
+  // align to avoid false sharing between head_ and tail_
+  alignas(hardware_interference_size) std::atomic<ticket_type> head_;
+  alignas(hardware_interference_size) std::atomic<ticket_type> tail_;
+};
+
+/// pool<T, Policies...>
+/// a fixed set of capacity objects recycled through a queue<T *> free list,
+/// so that objects travel from producers to consumers and back without
+/// touching the global allocator. in front of the free list sit magazines,
+/// small caches picked by the calling thread like the shards of
+/// sharded_stats, which refill from and spill to the free list half a
+/// magazine at a time with a single ticket claim. a magazine holds at most
+/// capacity / (2 * magazine_count) blocks, up to magazine_size, so the
+/// magazines together cache at most half the pool and small pools skip
+/// them. a magazine in use by another thread is bypassed for the free list.
+/// when its magazine and the free list are empty create takes a block from
+/// the magazines of other threads, so it returns nullptr only when every
+/// block is in use. the policies are those of the free list, which must keep the default
+/// cardinality policies. every object must be returned before the pool is
+/// destroyed.
+template <typename T, typename... Policies> class pool {
+  static_assert(
+      std::is_same<typename detail::find_policy<detail::producer_tag,
+                                                multi_producer,
+                                                Policies...>::type,
+                   multi_producer>::value &&
+          std::is_same<typename detail::find_policy<detail::consumer_tag,
+                                                    multi_consumer,
+                                                    Policies...>::type,
+                       multi_consumer>::value,
+      "free list must be multi_producer and multi_consumer");
+
+  static_assert(std::is_nothrow_destructible<T>::value,
+                "T must be nothrow destructible");
+
+public:
+  using free_list_type = queue<T *, Policies...>;
+
+  /// returns objects to the pool they were created from
+  class deleter {
+  public:
+    deleter() noexcept : pool_(nullptr) {}
+    explicit deleter(pool *p) noexcept : pool_(p) {}
+    void operator()(T *p) const noexcept { pool_->destroy(p); }
+
+  private:
+    pool *pool_;
+  };
+
+  /// owning pointer to a pooled object, move it through a queue<pointer>
+  /// and the object returns to the pool wherever the pointer is destroyed
+  using pointer = std::unique_ptr<T, deleter>;
+
+  static constexpr size_t magazine_size = 32;
+  static constexpr size_t magazine_count = 16;
+
+  explicit pool(const size_t capacity)
+      : capacity_(capacity), limit_(magazine_limit(capacity)),
+        free_(capacity), blocks_(nullptr) {
+    blocks_ = allocator_.allocate(capacity_);
+    for (size_t i = 0; i < capacity_; ++i) {
+      free_.push(reinterpret_cast<T *>(&blocks_[i]));
+    }
+  }
+
+  ~pool() noexcept { allocator_.deallocate(blocks_, capacity_); }
+
+  // non-copyable and non-movable
+  pool(const pool &) = delete;
+  pool &operator=(const pool &) = delete;
+
+  size_t capacity() const noexcept { return capacity_; }
+
+  /// constructs an object from args in a free block, returns nullptr if
+  /// none is available to the calling thread
+  template <typename... Args> T *create(Args &&...args) noexcept {
+    static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
+                  "T must be nothrow constructible with Args&&...");
+    auto const p = acquire_();
+    if (p == nullptr) {
+      return nullptr;
+    }
+    return new (p) T(std::forward<Args>(args)...);
+  }
+
+  /// destroys an object created by this pool and recycles its block
+  void destroy(T *p) noexcept {
+    p->~T();
+    release_(p);
+  }
+
+  /// like create but returns an owning pointer, empty if no block is
+  /// available to the calling thread
+  template <typename... Args> pointer make(Args &&...args) noexcept {
+    return pointer(create(std::forward<Args>(args)...), deleter(this));
+  }
+
+private:
+  // at least pointer aligned as posix_memalign requires
+  struct alignas(alignof(T) > alignof(void *) ? alignof(T)
+                                                : alignof(void *)) block {
+    unsigned char data[sizeof(T)];
+  };
+
+  struct alignas(hardware_interference_size) magazine {
+    std::atomic<bool> busy = {false};
+    size_t count = 0;
+    T *items[magazine_size];
+  };
+
+  magazine &local_() noexcept {
+    return magazines_[detail::thread_shard() % magazine_count];
+  }
+
+  // blocks a magazine may hold, 0 when the pool is too small to spare any
+  static size_t magazine_limit(const size_t capacity) noexcept {
+    auto const limit = capacity / (2 * magazine_count);
+    return limit < 2 ? 0 : limit < magazine_size ? limit : magazine_size;
+  }
+
+  T *acquire_() noexcept {
+    T *p = nullptr;
+    if (limit_ != 0) {
+      auto &m = local_();
+      if (!m.busy.exchange(true, std::memory_order_acquire)) {
+        if (m.count == 0) {
+          m.count = free_.try_pop_n(m.items, limit_ / 2);
+        }
+        if (m.count != 0) {
+          p = m.items[--m.count];
+        }
+        m.busy.store(false, std::memory_order_release);
+        if (p != nullptr) {
+          return p;
+        }
+      }
+    }
+    if (free_.try_pop(p) || limit_ == 0) {
+      return p;
+    }
+    // every block may be cached by the magazines of other threads, for
+    // example those of consumers that only destroy. a magazine is only held
+    // for a few non-blocking steps, so wait for it rather than skip it
+    for (auto &m : magazines_) {
+      while (m.busy.exchange(true, std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      if (m.count != 0) {
+        p = m.items[--m.count];
+      }
+      m.busy.store(false, std::memory_order_release);
+      if (p != nullptr) {
+        return p;
+      }
+    }
+    return nullptr;
+  }
+
+  // the free list holds every block so pushing to it never waits for room
+  void release_(T *p) noexcept {
+    if (limit_ == 0) {
+      free_.push(p);
+      return;
+    }
+    auto &m = local_();
+    if (m.busy.exchange(true, std::memory_order_acquire)) {
+      free_.push(p);
+      return;
+    }
+    if (m.count == limit_) {
+      free_.push_n(m.items + limit_ / 2, m.items + limit_);
+      m.count = limit_ / 2;
+    }
+    m.items[m.count++] = p;
+    m.busy.store(false, std::memory_order_release);
+  }
+
+  const size_t capacity_;
+  const size_t limit_;
+  free_list_type free_;
+  aligned_allocator<block> allocator_;
+  block *blocks_;
+  magazine magazines_[magazine_count];
+};
+
+/// work_stealing_deque<T>
+/// a bounded chase-lev deque where one owner thread pushes and pops at the
+/// bottom while any thread steals from the top, so the owner works lifo on
+/// hot data and thieves take the oldest items. the capacity is rounded up
+/// to a power of two. T must be trivially copyable since a thief may read
+/// an item it then loses to the owner or another thief, items are kept in
+/// atomics so that read is benign. the indices are accessed with sequential
+/// consistency where the algorithm needs a fence, which also keeps it
+/// visible to thread sanitizer.
+template <typename T> class work_stealing_deque {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "T must be trivially copyable");
+
+public:
+  explicit work_stealing_deque(const size_t capacity)
+      : mask_(round_up(capacity) - 1),
+        items_(new std::atomic<T>[mask_ + 1]), top_(0), bottom_(0) {}
+
+  // non-copyable and non-movable
+  work_stealing_deque(const work_stealing_deque &) = delete;
+  work_stealing_deque &operator=(const work_stealing_deque &) = delete;
+
+  size_t capacity() const noexcept { return mask_ + 1; }
+
+  /// push an item at the bottom, owner only. returns false if full.
+  bool push(const T &v) noexcept {
+    auto const b = bottom_.load(std::memory_order_relaxed);
+    auto const t = top_.load(std::memory_order_acquire);
+    if (b - t > static_cast<int64_t>(mask_)) {
+      return false;
+    }
+    items_[static_cast<size_t>(b) & mask_].store(v, std::memory_order_relaxed);
+    bottom_.store(b + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// pop the newest item from the bottom, owner only. returns false if
+  /// empty or the last item was stolen.
+  bool pop(T &v) noexcept {
+    auto const b = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(b, std::memory_order_seq_cst);
+    auto t = top_.load(std::memory_order_seq_cst);
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    v = items_[static_cast<size_t>(b) & mask_].load(std::memory_order_relaxed);
+    if (t == b) {
+      // last item, race the thieves for it
+      auto const won = top_.compare_exchange_strong(
+          t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  /// steal the oldest item from the top, any thread. returns false if empty
+  /// or another thread took the item first.
+  bool steal(T &v) noexcept {
+    auto t = top_.load(std::memory_order_seq_cst);
+    auto const b = bottom_.load(std::memory_order_seq_cst);
+    if (t >= b) {
+      return false;
+    }
+    auto const item =
+        items_[static_cast<size_t>(t) & mask_].load(std::memory_order_relaxed);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return false;
+    }
+    v = item;
+    return true;
+  }
+
+  /// returns the number of items, a best effort guess like queue::size.
+  size_t size() const noexcept {
+    auto const b = bottom_.load(std::memory_order_seq_cst);
+    auto const t = top_.load(std::memory_order_seq_cst);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+  }
+
+  bool empty() const noexcept { return size() == 0; }
+
+private:
+  static size_t round_up(const size_t capacity) {
+    if (capacity < 1 || capacity > (std::numeric_limits<size_t>::max() >> 2)) {
+      throw std::invalid_argument("capacity out of range");
+    }
+    size_t n = 1;
+    while (n < capacity) {
+      n *= 2;
+    }
+    return n;
+  }
+
+  const size_t mask_;
+  std::unique_ptr<std::atomic<T>[]> items_;
+
+  // align to avoid false sharing between the thieves and the owner
+  alignas(hardware_interference_size) std::atomic<int64_t> top_;
+  alignas(hardware_interference_size) std::atomic<int64_t> bottom_;
+};
+
+/// a unit of work for scheduler. embed it in the object the work belongs to
+/// so that scheduling it allocates nothing, run is called once on a worker.
+struct task {
+  explicit task(void (*f)(task *)) noexcept : run(f) {}
+  void (*run)(task *);
+};
+
+namespace detail {
+// the scheduler and index of the worker running on the calling thread
+struct worker_context {
+  const void *owner;
+  size_t index;
+};
+
+inline worker_context &this_worker() noexcept {
+  static thread_local worker_context context = {nullptr, 0};
+  return context;
+}
+} // namespace detail
+
+/// scheduler<Policies...>
+/// runs tasks on a fixed set of worker threads. each worker has a
+/// work_stealing_deque for the tasks it schedules itself, tasks from other
+/// threads and from full deques go to a shared queue<task *, Policies...>,
+/// the injection queue. a worker looks for work in its deque, then takes a
+/// batch from the injection queue with a single ticket claim, then steals
+/// from the other workers starting at a random one. a worker that finds
+/// nothing parks with the wait policy (park_wait by default). schedulers
+/// only touch the shared wake counter when a worker is idle, so the hot
+/// path stays on the deque of the worker. the destructor runs every task
+/// scheduled before it and joins the workers, tasks must not be scheduled
+/// from other threads once it has started. the injection queue must keep
+/// the default cardinality policies.
+template <typename... Policies> class scheduler {
+  static_assert(
+      std::is_same<typename detail::find_policy<detail::producer_tag,
+                                                multi_producer,
+                                                Policies...>::type,
+                   multi_producer>::value &&
+          std::is_same<typename detail::find_policy<detail::consumer_tag,
+                                                    multi_consumer,
+                                                    Policies...>::type,
+                       multi_consumer>::value,
+      "injection queue must be multi_producer and multi_consumer");
+
+  using wait_type =
+      typename detail::find_policy<detail::wait_tag, park_wait,
+                                   Policies...>::type;
+
+public:
+  using injection_queue_type = queue<task *, Policies...>;
+
+  /// the most tasks a worker takes from the injection queue at once
+  static constexpr size_t injection_batch = 16;
+
+  explicit scheduler(
+      const size_t workers = std::max(1u, std::thread::hardware_concurrency()),
+      const size_t deque_capacity = 1024,
+      const size_t injection_capacity = 4096)
+      : count_(workers), workers_(nullptr), injection_(injection_capacity),
+        idle_(0), wake_(0), stopping_(false) {
+    if (workers < 1) {
+      throw std::invalid_argument("workers < 1");
+    }
+    workers_ = allocator_.allocate(count_);
+    for (size_t i = 0; i < count_; ++i) {
+      // the deque must hold a whole batch from the injection queue
+      new (&workers_[i])
+          worker(std::max(deque_capacity, size_t(injection_batch)), i);
+    }
+    try {
+      for (size_t i = 0; i < count_; ++i) {
+        threads_.push_back(std::thread([this, i] { run_(i); }));
+      }
+    } catch (...) {
+      stop_();
+      throw;
+    }
+  }
+
+  ~scheduler() noexcept { stop_(); }
+
+  // non-copyable and non-movable
+  scheduler(const scheduler &) = delete;
+  scheduler &operator=(const scheduler &) = delete;
+
+  size_t worker_count() const noexcept { return count_; }
+
+  /// schedules t to run on a worker. from a worker of this scheduler it goes
+  /// to its deque and spills to the injection queue, or runs inline when
+  /// both are full. from any other thread it goes to the injection queue,
+  /// blocking while it is full.
+  void schedule(task *t) noexcept {
+    auto const &context = detail::this_worker();
+    if (context.owner == this) {
+      if (!workers_[context.index].deque.push(t) && !injection_.try_push(t)) {
+        t->run(t);
+        return;
+      }
+    } else {
+      injection_.push(t);
+    }
+    wake_idle_();
+  }
+
+  /// schedules a copy of f, allocated on the heap and deleted after it ran.
+  /// f must not throw.
+  template <typename F> void submit(F &&f) {
+    schedule(new function_task<typename std::decay<F>::type>(
+        std::forward<F>(f)));
+  }
+
+private:
+  template <typename F> struct function_task : task {
+    template <typename G>
+    explicit function_task(G &&g) : task(&invoke), f(std::forward<G>(g)) {}
+
+    static void invoke(task *t) noexcept {
+      auto const p = static_cast<function_task *>(t);
+      p->f();
+      delete p;
+    }
+
+    F f;
+  };
+
+  struct worker {
+    worker(const size_t capacity, const size_t index)
+        : deque(capacity), rng(index * 0x9e3779b97f4a7c15ull + 1) {}
+
+    work_stealing_deque<task *> deque;
+    uint64_t rng;
+  };
+
+  void run_(const size_t index) noexcept {
+    auto &context = detail::this_worker();
+    context.owner = this;
+    context.index = index;
+    for (;;) {
+      auto const t = find_(workers_[index]);
+      if (t != nullptr) {
+        t->run(t);
+      } else if (!idle_wait_()) {
+        break;
+      }
+    }
+    context.owner = nullptr;
+  }
+
+  task *find_(worker &w) noexcept {
+    task *t = nullptr;
+    if (w.deque.pop(t)) {
+      return t;
+    }
+    task *batch[injection_batch];
+    auto const n = injection_.try_pop_n(batch, injection_batch);
+    if (n != 0) {
+      for (size_t i = 1; i < n; ++i) {
+        w.deque.push(batch[i]);
+      }
+      if (n > 1) {
+        wake_idle_();
+      }
+      return batch[0];
+    }
+    // xorshift picks the first victim so thieves spread over the workers
+    w.rng ^= w.rng << 13;
+    w.rng ^= w.rng >> 7;
+    w.rng ^= w.rng << 17;
+    auto const start = static_cast<size_t>(w.rng % count_);
+    for (size_t i = 0; i < count_; ++i) {
+      auto &victim = workers_[(start + i) % count_];
+      if (&victim != &w && victim.deque.steal(t)) {
+        return t;
+      }
+    }
+    return nullptr;
+  }
+
+  // returns true if there may be work anywhere
+  bool has_work_() const noexcept {
+    if (!injection_.empty()) {
+      return true;
+    }
+    for (size_t i = 0; i < count_; ++i) {
+      if (!workers_[i].deque.empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // parks until woken, returns false once the scheduler is stopping and no
+  // work is left
+  bool idle_wait_() noexcept {
+    auto const seen = wake_.load(std::memory_order_acquire);
+    idle_.fetch_add(1, std::memory_order_seq_cst);
+    // pairs with the fence in wake_idle_, either the scheduling thread sees
+    // the idle worker or the idle worker sees the work
+#if !defined(MPMC_THREAD_SANITIZER)
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+    auto const ready = has_work_();
+    if (!ready && !stopping_.load(std::memory_order_acquire)) {
+      wait_type::wait(wake_, [this, seen]() noexcept {
+        return wake_.load(std::memory_order_acquire) != seen;
+      });
+    }
+    idle_.fetch_sub(1, std::memory_order_relaxed);
+    // tasks scheduled before the stop are visible once stopping_ is, so
+    // look again rather than trusting the check made before the wait
+    return !stopping_.load(std::memory_order_acquire) || has_work_();
+  }
+
+  void wake_idle_() noexcept {
+#if defined(MPMC_THREAD_SANITIZER)
+    if (idle_.fetch_add(0, std::memory_order_seq_cst) != 0) {
+#else
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (idle_.load(std::memory_order_relaxed) != 0) {
+#endif
+      wake_.fetch_add(1, std::memory_order_release);
+      wait_type::notify(wake_);
+    }
+  }
+
+  void stop_() noexcept {
+    stopping_.store(true, std::memory_order_release);
+    wake_.fetch_add(1, std::memory_order_release);
+    wait_type::notify(wake_);
+    for (auto &t : threads_) {
+      t.join();
+    }
+    for (size_t i = 0; i < count_; ++i) {
+      workers_[i].~worker();
+    }
+    allocator_.deallocate(workers_, count_);
+  }
+
+  const size_t count_;
+  aligned_allocator<worker> allocator_;
+  worker *workers_;
+  std::vector<std::thread> threads_;
+  injection_queue_type injection_;
+
+  // idle_ counts the workers looking for work to park, wake_ is bumped to
+  // wake them and only written while some worker is idle
+  alignas(hardware_interference_size) std::atomic<size_t> idle_;
+  std::atomic<ticket_type> wake_;
+  std::atomic<bool> stopping_;
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+/// interprocess_queue<T, Policies...>
+/// a queue placed in a named posix shared memory segment so that producers
+/// and consumers can live in different processes. the segment starts with a
+/// header carrying a magic number, the layout version, the capacity and the
+/// sizes of T and of a slot, followed by head, tail and the slots. nothing in
+/// the segment is a pointer, every process computes the address of the slots
+/// from where it mapped the segment. T must be trivially copyable since the
+/// elements are shared between processes. accepts the layout policies and
+/// the spin_wait and backoff_wait wait policies, park_wait parks threads
+/// on a process local parking lot and cannot wake other processes.
+template <typename T, typename... Policies> class interprocess_queue {
+private:
+  using layout_type =
+      typename detail::find_policy<detail::layout_tag, padded_slots,
+                                   Policies...>::type;
+  using slot_type = typename layout_type::template slot_type<T>;
+  using mapping_type = typename layout_type::template mapping<T>;
+  using wait_type =
+      typename detail::find_policy<detail::wait_tag, spin_wait,
+                                   Policies...>::type;
+
+  static_assert(std::is_trivially_copyable<T>::value,
+                "T must be trivially copyable");
+  static_assert(!std::is_base_of<park_wait, wait_type>::value,
+                "park_wait and coroutine_wait cannot wake threads in other "
+                "processes");
+#if defined(__cpp_lib_atomic_is_always_lock_free)
+  static_assert(std::atomic<ticket_type>::is_always_lock_free,
+                "atomics must be lock free to be shared between processes");
+#endif
+
+  struct alignas(hardware_interference_size) header {
+    std::atomic<uint64_t> magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint64_t value_size;
+    uint64_t capacity;
+  };
+
+  // the shared part of the queue, the slots follow it
+  struct region {
+    header hdr;
+    // align to avoid false sharing between head and tail
+    alignas(hardware_interference_size) std::atomic<ticket_type> head;
+    alignas(hardware_interference_size) std::atomic<ticket_type> tail;
+  };
+
+public:
+  static constexpr uint64_t magic = 0x6d706d6371756575; // "mpmcqueu"
+  static constexpr uint32_t version = 2;
+
+  /// creates the shared memory segment name holding a queue of capacity
+  /// elements. throws std::system_error if the segment already exists or
+  /// cannot be created.
+  static interprocess_queue create(const std::string &name,
+                                   const size_t capacity) {
+    if (capacity < 1) {
+      throw std::invalid_argument("capacity < 1");
+    }
+    if (capacity > (std::numeric_limits<size_t>::max() - sizeof(region)) /
+                       sizeof(slot_type)) {
+      throw std::invalid_argument("capacity too large");
+    }
+    auto const size = sizeof(region) + capacity * sizeof(slot_type);
+    auto const fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) {
+      throw std::system_error(errno, std::generic_category(), "shm_open");
+    }
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      auto const err = errno;
+      close(fd);
+      shm_unlink(name.c_str());
+      throw std::system_error(err, std::generic_category(), "ftruncate");
+    }
+    void *p = map_(fd, size);
+    if (p == nullptr) {
+      auto const err = errno;
+      shm_unlink(name.c_str());
+      throw std::system_error(err, std::generic_category(), "mmap");
+    }
+    auto *r = new (p) region();
+    r->hdr.version = version;
+    r->hdr.slot_size = static_cast<uint32_t>(sizeof(slot_type));
+    r->hdr.value_size = sizeof(T);
+    r->hdr.capacity = capacity;
+    r->head.store(0, std::memory_order_relaxed);
+    r->tail.store(0, std::memory_order_relaxed);
+    auto *slots = reinterpret_cast<slot_type *>(r + 1);
+    for (size_t i = 0; i < capacity; ++i) {
+      new (&slots[i]) slot_type();
+    }
+    // publishing the magic marks the segment as initialized
+    r->hdr.magic.store(magic, std::memory_order_release);
+    return interprocess_queue(r, size, capacity);
+  }
+
+  /// attaches to the queue in the shared memory segment name created by
+  /// another process. throws std::system_error if it cannot be opened and
+  /// std::runtime_error if it is not initialized yet, was created for a
+  /// different T, layout or version or its header does not fit the
+  /// segment. the header is not trusted, every field is checked before it
+  /// is used.
+  static interprocess_queue open(const std::string &name) {
+    auto const fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd == -1) {
+      throw std::system_error(errno, std::generic_category(), "shm_open");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      auto const err = errno;
+      close(fd);
+      throw std::system_error(err, std::generic_category(), "fstat");
+    }
+    auto const size = static_cast<size_t>(st.st_size);
+    if (size < sizeof(region)) {
+      close(fd);
+      throw std::runtime_error("shared memory segment is not initialized");
+    }
+    void *p = map_(fd, size);
+    if (p == nullptr) {
+      throw std::system_error(errno, std::generic_category(), "mmap");
+    }
+    auto *r = static_cast<region *>(p);
+    if (r->hdr.magic.load(std::memory_order_acquire) != magic) {
+      munmap(p, size);
+      throw std::runtime_error("shared memory segment is not initialized");
+    }
+    // the capacity is read once, another process may still change it
+    auto const capacity = r->hdr.capacity;
+    if (r->hdr.version != version ||
+        r->hdr.slot_size != sizeof(slot_type) ||
+        r->hdr.value_size != sizeof(T) || capacity == 0 ||
+        capacity > (size - sizeof(region)) / sizeof(slot_type)) {
+      munmap(p, size);
+      throw std::runtime_error("shared memory segment is incompatible");
+    }
+    try {
+      return interprocess_queue(r, size, static_cast<size_t>(capacity));
+    } catch (...) {
+      munmap(p, size);
+      throw;
+    }
+  }
+
+  /// removes the name of the shared memory segment, processes that have it
+  /// mapped keep using it. returns false if there is no such segment.
+  static bool remove(const std::string &name) noexcept {
+    return shm_unlink(name.c_str()) == 0;
+  }
+
+  interprocess_queue(interprocess_queue &&other) noexcept
+      : region_(other.region_), size_(other.size_), slots_(other.slots_),
+        capacity_(other.capacity_), mapping_(other.mapping_) {
+    other.region_ = nullptr;
+  }
+
+  /// unmaps the segment, the queue lives on in the segment
+  ~interprocess_queue() noexcept {
+    if (region_ != nullptr) {
+      munmap(region_, size_);
+    }
+  }
+
+  // non-copyable and non-assignable
+  interprocess_queue(const interprocess_queue &) = delete;
+  interprocess_queue &operator=(const interprocess_queue &) = delete;
+  interprocess_queue &operator=(interprocess_queue &&) = delete;
+
+  size_t capacity() const noexcept { return capacity_.capacity(); }
+
+  template <typename... Args> void emplace(Args &&...args) noexcept {
+    static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
+                  "T must be nothrow constructible with Args&&...");
+    auto const head = region_->head.fetch_add(1);
+    auto &slot = slots_[idx_(head)];
+    auto const turn = capacity_.turn(head) * 2;
+    wait_type::wait(slot.turn, [&slot, turn]() noexcept {
+      return turn == slot.turn.load(std::memory_order_acquire);
+    });
+    publish_(head, std::forward<Args>(args)...);
+  }
+
+  template <typename... Args> bool try_emplace(Args &&...args) noexcept {
+    static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
+                  "T must be nothrow constructible with Args&&...");
+    auto head = region_->head.load(std::memory_order_acquire);
+    for (;;) {
+      auto &slot = slots_[idx_(head)];
+      if (capacity_.turn(head) * 2 ==
+          slot.turn.load(std::memory_order_acquire)) {
+        if (region_->head.compare_exchange_strong(head, head + 1)) {
+          publish_(head, std::forward<Args>(args)...);
+          return true;
+        }
+      } else {
+        auto const prev_head = head;
+        head = region_->head.load(std::memory_order_acquire);
+        if (head == prev_head) {
+          return false;
+        }
+      }
+    }
+  }
+
+  void push(const T &v) noexcept { emplace(v); }
+
+  bool try_push(const T &v) noexcept { return try_emplace(v); }
+
+  void pop(T &v) noexcept {
+    auto const tail = region_->tail.fetch_add(1);
+    auto &slot = slots_[idx_(tail)];
+    auto const turn = capacity_.turn(tail) * 2 + 1;
+    wait_type::wait(slot.turn, [&slot, turn]() noexcept {
+      return turn == slot.turn.load(std::memory_order_acquire);
+    });
+    consume_(tail, v);
+  }
+
+  bool try_pop(T &v) noexcept {
+    auto tail = region_->tail.load(std::memory_order_acquire);
+    for (;;) {
+      auto &slot = slots_[idx_(tail)];
+      if (capacity_.turn(tail) * 2 + 1 ==
+          slot.turn.load(std::memory_order_acquire)) {
+        if (region_->tail.compare_exchange_strong(tail, tail + 1)) {
+          consume_(tail, v);
+          return true;
+        }
+      } else {
+        auto const prev_tail = tail;
+        tail = region_->tail.load(std::memory_order_acquire);
+        if (tail == prev_tail) {
+          return false;
+        }
+      }
+    }
+  }
+
+  /// returns the number of elements in the queue across all processes, a
+  /// best effort guess like queue::size.
+  ptrdiff_t size() const noexcept {
+    auto const tail = region_->tail.load(std::memory_order_acquire);
+    auto const head = region_->head.load(std::memory_order_relaxed);
+    return static_cast<ptrdiff_t>(static_cast<int64_t>(head - tail));
+  }
+
+  bool empty() const noexcept { return size() <= 0; }
+
+private:
+  interprocess_queue(region *r, const size_t size, const size_t capacity)
+      : region_(r), size_(size), slots_(reinterpret_cast<slot_type *>(r + 1)),
+        capacity_(capacity), mapping_(capacity_.capacity()) {}
+
+  // maps the whole segment and closes fd, returns nullptr on failure
+  static void *map_(const int fd, const size_t size) noexcept {
+    void *p =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    auto const err = errno;
+    close(fd);
+    errno = err;
+    return p == MAP_FAILED ? nullptr : p;
+  }
+
+  template <typename... Args>
+  void publish_(ticket_type const head, Args &&...args) noexcept {
+    auto &slot = slots_[idx_(head)];
+    slot.construct(std::forward<Args>(args)...);
+    slot.turn.store(capacity_.turn(head) * 2 + 1, std::memory_order_release);
+    wait_type::notify(slot.turn);
+  }
+
+  void consume_(ticket_type const tail, T &v) noexcept {
+    auto &slot = slots_[idx_(tail)];
+    v = slot.move();
+    slot.turn.store(capacity_.turn(tail) * 2 + 2, std::memory_order_release);
+    wait_type::notify(slot.turn);
+  }
+
+  size_t idx_(ticket_type i) const noexcept {
+    return mapping_(capacity_.idx(i));
+  }
+
+  region *region_;
+  size_t size_;
+  slot_type *slots_;
+  dynamic_capacity capacity_;
+  mapping_type mapping_;
+};
+#endif
 
 } // namespace mpmc
@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mpmc/mpmcqueue.hpp>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h> // pthread_setaffinity_np
+#include <sched.h>   // cpu_set_t
+#endif
+
+#if defined(MPMC_BENCH_BOOST)
+#include <boost/lockfree/queue.hpp>
+#endif
+
+#if defined(MPMC_BENCH_MOODYCAMEL)
+#include <concurrentqueue.h>
+#endif
+
+// benchmarks throughput and round trip latency of the queue, optionally next
+// to other queues. usage:
+// mpmc_queue_bench [--pin] [--throughput|--latency] [--ops=N] [--samples=N]
+
+namespace {
+
+struct options {
+  bool pin = false;
+  bool throughput = true;
+  bool latency = true;
+  uint64_t ops = 1000000;
+  size_t samples = 100000;
+};
+
+// payload of N bytes, the first word carries a sequence number
+template <size_t N> struct payload {
+  static_assert(N % sizeof(uint64_t) == 0, "N must be a multiple of 8");
+  uint64_t data[N / sizeof(uint64_t)];
+};
+
+void pin_thread(const options &opts, size_t i) {
+#if defined(__linux__)
+  if (!opts.pin) {
+    return;
+  }
+  auto const cpus = std::max(1u, std::thread::hardware_concurrency());
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(i % cpus, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)opts, (void)i;
+#endif
+}
+
+// adapters give every queue the same interface, queues without a blocking
+// operation spin on the try operation. the queues are never closed, so a
+// blocking pop always writes its item
+template <typename T> struct mpmc_adapter {
+  static const char *name() { return "mpmc::queue"; }
+  explicit mpmc_adapter(size_t capacity) : q(capacity) {}
+  void push(const T &v) { q.push(v); }
+  void pop(T &v) { (void)q.pop(v); }
+  bool try_push(const T &v) { return q.try_push(v); }
+  bool try_pop(T &v) { return q.try_pop(v); }
+  mpmc::queue<T> q;
+};
+
+template <typename T> struct mpmc_pow2_adapter {
+  static const char *name() { return "mpmc::queue<pow2>"; }
+  explicit mpmc_pow2_adapter(size_t capacity) : q(capacity) {}
+  void push(const T &v) { q.push(v); }
+  void pop(T &v) { (void)q.pop(v); }
+  bool try_push(const T &v) { return q.try_push(v); }
+  bool try_pop(T &v) { return q.try_pop(v); }
+  mpmc::queue<T, mpmc::power_of_two_capacity> q;
+};
+
+template <typename T> struct mpmc_prefetch_adapter {
+  static const char *name() { return "mpmc::queue<prefetch>"; }
+  explicit mpmc_prefetch_adapter(size_t capacity) : q(capacity) {}
+  void push(const T &v) { q.push(v); }
+  void pop(T &v) { (void)q.pop(v); }
+  bool try_push(const T &v) { return q.try_push(v); }
+  bool try_pop(T &v) { return q.try_pop(v); }
+  mpmc::queue<T, mpmc::prefetch_ahead<>> q;
+};
+
+#if defined(MPMC_BENCH_BOOST)
+template <typename T> struct boost_adapter {
+  static const char *name() { return "boost::lockfree::queue"; }
+  explicit boost_adapter(size_t capacity) : q(capacity) {}
+  void push(const T &v) {
+    while (!q.bounded_push(v)) {
+    }
+  }
+  void pop(T &v) {
+    while (!q.pop(v)) {
+    }
+  }
+  bool try_push(const T &v) { return q.bounded_push(v); }
+  bool try_pop(T &v) { return q.pop(v); }
+  boost::lockfree::queue<T> q;
+};
+#endif
+
+#if defined(MPMC_BENCH_MOODYCAMEL)
+template <typename T> struct moodycamel_adapter {
+  static const char *name() { return "moodycamel::ConcurrentQueue"; }
+  explicit moodycamel_adapter(size_t capacity) : q(capacity) {}
+  void push(const T &v) {
+    while (!q.try_enqueue(v)) {
+    }
+  }
+  void pop(T &v) {
+    while (!q.try_dequeue(v)) {
+    }
+  }
+  bool try_push(const T &v) { return q.try_enqueue(v); }
+  bool try_pop(T &v) { return q.try_dequeue(v); }
+  moodycamel::ConcurrentQueue<T> q;
+};
+#endif
+
+template <typename Queue, typename T>
+void push(Queue &q, const T &v, bool blocking) {
+  if (blocking) {
+    q.push(v);
+  } else {
+    while (!q.try_push(v)) {
+      mpmc::detail::cpu_relax();
+    }
+  }
+}
+
+template <typename Queue, typename T>
+void pop(Queue &q, T &v, bool blocking) {
+  if (blocking) {
+    q.pop(v);
+  } else {
+    while (!q.try_pop(v)) {
+      mpmc::detail::cpu_relax();
+    }
+  }
+}
+
+// returns operations per second with the given number of producers and
+// consumers moving ops items through the queue
+template <template <typename> class Adapter, typename T>
+double throughput(const options &opts, size_t producers, size_t consumers,
+                  size_t capacity, bool blocking) {
+  Adapter<T> q(capacity);
+  auto const per_producer = opts.ops / producers;
+  auto const total = per_producer * producers;
+  std::atomic<size_t> ready(0);
+  std::atomic<bool> go(false);
+  std::atomic<uint64_t> checksum(0);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < producers; ++i) {
+    threads.push_back(std::thread([&, i] {
+      pin_thread(opts, i);
+      T v;
+      std::memset(&v, 0, sizeof(v));
+      ready.fetch_add(1);
+      while (!go.load(std::memory_order_acquire)) {
+      }
+      for (uint64_t j = 0; j < per_producer; ++j) {
+        v.data[0] = j;
+        push(q, v, blocking);
+      }
+    }));
+  }
+  for (size_t i = 0; i < consumers; ++i) {
+    threads.push_back(std::thread([&, i] {
+      pin_thread(opts, producers + i);
+      auto const n = total / consumers + (i < total % consumers ? 1 : 0);
+      uint64_t sum = 0;
+      T v{};
+      ready.fetch_add(1);
+      while (!go.load(std::memory_order_acquire)) {
+      }
+      for (uint64_t j = 0; j < n; ++j) {
+        pop(q, v, blocking);
+        sum += v.data[0];
+      }
+      checksum.fetch_add(sum);
+    }));
+  }
+  while (ready.load() != producers + consumers) {
+    std::this_thread::yield();
+  }
+  auto const start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (auto &t : threads) {
+    t.join();
+  }
+  auto const stop = std::chrono::steady_clock::now();
+  if (checksum.load() != producers * (per_producer * (per_producer - 1) / 2)) {
+    std::fprintf(stderr, "%s: checksum mismatch\n", Adapter<T>::name());
+    std::exit(1);
+  }
+  return static_cast<double>(total) /
+         std::chrono::duration<double>(stop - start).count();
+}
+
+struct percentiles {
+  double p50, p99, p999;
+};
+
+// returns the round trip latency in nanoseconds of sending an item to an
+// echo thread and receiving it back through a second queue
+template <template <typename> class Adapter, typename T>
+percentiles latency(const options &opts, size_t capacity, bool blocking) {
+  Adapter<T> ping(capacity);
+  Adapter<T> pong(capacity);
+  auto const samples = opts.samples;
+  auto echo = std::thread([&] {
+    pin_thread(opts, 1);
+    T v{};
+    for (size_t i = 0; i < samples; ++i) {
+      pop(ping, v, blocking);
+      push(pong, v, blocking);
+    }
+  });
+  pin_thread(opts, 0);
+  std::vector<double> rtt(samples);
+  T v;
+  std::memset(&v, 0, sizeof(v));
+  for (size_t i = 0; i < samples; ++i) {
+    v.data[0] = i;
+    auto const start = std::chrono::steady_clock::now();
+    push(ping, v, blocking);
+    pop(pong, v, blocking);
+    auto const stop = std::chrono::steady_clock::now();
+    rtt[i] = std::chrono::duration<double, std::nano>(stop - start).count();
+  }
+  echo.join();
+  std::sort(rtt.begin(), rtt.end());
+  auto const at = [&](double q) {
+    return rtt[std::min(rtt.size() - 1, static_cast<size_t>(q * rtt.size()))];
+  };
+  return percentiles{at(0.5), at(0.99), at(0.999)};
+}
+
+template <template <typename> class Adapter, size_t N>
+void run_payload(const options &opts) {
+  static const size_t counts[][2] = {{1, 1}, {1, 4}, {4, 1}, {2, 2}, {4, 4}};
+  static const size_t capacities[] = {64, 1024, 65536};
+  for (auto blocking : {true, false}) {
+    for (auto capacity : capacities) {
+      for (auto &c : counts) {
+        auto const ops = throughput<Adapter, payload<N>>(opts, c[0], c[1],
+                                                         capacity, blocking);
+        std::printf("%-28s %4zu %6zu %4zu %4zu %-5s %14.0f\n",
+                    Adapter<payload<N>>::name(), N, capacity, c[0], c[1],
+                    blocking ? "block" : "try", ops);
+      }
+    }
+  }
+}
+
+template <template <typename> class Adapter>
+void run_throughput(const options &opts) {
+  run_payload<Adapter, 8>(opts);
+  run_payload<Adapter, 64>(opts);
+  run_payload<Adapter, 256>(opts);
+  run_payload<Adapter, 512>(opts);
+}
+
+template <template <typename> class Adapter, size_t N>
+void run_latency_payload(const options &opts) {
+  for (auto blocking : {true, false}) {
+    auto const p = latency<Adapter, payload<N>>(opts, 1024, blocking);
+    std::printf("%-28s %4zu %-5s %10.0f %10.0f %10.0f\n",
+                Adapter<payload<N>>::name(), N, blocking ? "block" : "try",
+                p.p50, p.p99, p.p999);
+  }
+}
+
+template <template <typename> class Adapter>
+void run_latency(const options &opts) {
+  run_latency_payload<Adapter, 8>(opts);
+  run_latency_payload<Adapter, 64>(opts);
+  run_latency_payload<Adapter, 256>(opts);
+  run_latency_payload<Adapter, 512>(opts);
+}
+
+template <template <typename> class... Adapters> struct suite;
+
+template <> struct suite<> {
+  static void throughput(const options &) {}
+  static void latency(const options &) {}
+};
+
+template <template <typename> class Adapter,
+          template <typename> class... Adapters>
+struct suite<Adapter, Adapters...> {
+  static void throughput(const options &opts) {
+    run_throughput<Adapter>(opts);
+    suite<Adapters...>::throughput(opts);
+  }
+  static void latency(const options &opts) {
+    run_latency<Adapter>(opts);
+    suite<Adapters...>::latency(opts);
+  }
+};
+
+using all = suite<mpmc_adapter, mpmc_pow2_adapter, mpmc_prefetch_adapter
+#if defined(MPMC_BENCH_BOOST)
+                  ,
+                  boost_adapter
+#endif
+#if defined(MPMC_BENCH_MOODYCAMEL)
+                  ,
+                  moodycamel_adapter
+#endif
+                  >;
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  options opts;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--pin") == 0) {
+      opts.pin = true;
+    } else if (std::strcmp(argv[i], "--throughput") == 0) {
+      opts.latency = false;
+    } else if (std::strcmp(argv[i], "--latency") == 0) {
+      opts.throughput = false;
+    } else if (std::strncmp(argv[i], "--ops=", 6) == 0) {
+      opts.ops = std::strtoull(argv[i] + 6, nullptr, 10);
+    } else if (std::strncmp(argv[i], "--samples=", 10) == 0) {
+      opts.samples = std::strtoull(argv[i] + 10, nullptr, 10);
+    } else {
+      std::fprintf(stderr,
+                   "usage: %s [--pin] [--throughput|--latency] [--ops=N] "
+                   "[--samples=N]\n",
+                   argv[0]);
+      return 1;
+    }
+  }
+  if (opts.ops == 0 || opts.samples == 0) {
+    std::fprintf(stderr, "ops and samples must be positive\n");
+    return 1;
+  }
+
+  if (opts.throughput) {
+    std::printf("%-28s %4s %6s %4s %4s %-5s %14s\n", "queue", "size", "cap",
+                "prod", "cons", "api", "ops/s");
+    all::throughput(opts);
+  }
+  if (opts.latency) {
+    std::printf("%-28s %4s %-5s %10s %10s %10s\n", "queue", "size", "api",
+                "p50 ns", "p99 ns", "p999 ns");
+    all::latency(opts);
+  }
+
+  return 0;
+}
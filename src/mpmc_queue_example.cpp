@@ -8,13 +8,15 @@ int main(int argc, char *argv[]) {
   mpmc::queue<int> q(10);
   auto t1 = std::thread([&] {
     int v;
-    q.pop(v);
-    std::cout << "t1 " << v << "\n";
+    if (q.pop(v)) {
+      std::cout << "t1 " << v << "\n";
+    }
   });
   auto t2 = std::thread([&] {
     int v;
-    q.pop(v);
-    std::cout << "t2 " << v << "\n";
+    if (q.pop(v)) {
+      std::cout << "t2 " << v << "\n";
+    }
   });
   q.push(1);
   q.push(2);
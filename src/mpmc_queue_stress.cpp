@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mpmc/mpmcqueue.hpp>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h> // pthread_setaffinity_np
+#include <sched.h>   // cpu_set_t
+#endif
+
+// stress tests the queue variants with more threads than cores, mixing the
+// blocking, try and bulk operations. every item carries its producer and
+// sequence number, consumers check that the items of each producer arrive in
+// order and intact and at the end every item must have been seen exactly
+// once. build with -fsanitize=thread or -fsanitize=address to check the
+// memory orderings and the slot lifetimes along the way. usage:
+// mpmc_queue_stress [--pin] [--producers=N] [--consumers=N] [--ops=N]
+//                   [--capacity=N] [--rounds=N]
+
+namespace {
+
+struct options {
+  bool pin = false;
+  size_t producers = std::thread::hardware_concurrency() + 1;
+  size_t consumers = std::thread::hardware_concurrency() + 1;
+  uint64_t ops = 100000;
+  size_t capacity = 64;
+  uint64_t rounds = 1;
+};
+
+// an item of producer p with sequence number seq, check detects torn reads
+struct item {
+  uint64_t producer;
+  uint64_t seq;
+  uint64_t check;
+};
+
+uint64_t checksum(uint64_t producer, uint64_t seq) {
+  return (producer * 0x9e3779b97f4a7c15ull) ^ (seq + 0x632be59bd9b4e019ull);
+}
+
+[[noreturn]] void fail(const char *name, const char *what, const item &v) {
+  std::fprintf(stderr, "%s: %s (producer %llu seq %llu)\n", name, what,
+               static_cast<unsigned long long>(v.producer),
+               static_cast<unsigned long long>(v.seq));
+  std::exit(1);
+}
+
+[[noreturn]] void fail(const char *name, const char *what) {
+  std::fprintf(stderr, "%s: %s\n", name, what);
+  std::exit(1);
+}
+
+void pin_thread(const options &opts, size_t i) {
+#if defined(__linux__)
+  if (!opts.pin) {
+    return;
+  }
+  auto const cpus = std::max(1u, std::thread::hardware_concurrency());
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(i % cpus, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)opts, (void)i;
+#endif
+}
+
+// one round moves opts.ops items from every producer to the consumers and
+// returns the number of items checked
+template <typename Queue>
+uint64_t stress_round(const char *name, const options &opts, Queue &q) {
+  auto const total = opts.ops * opts.producers;
+  // seen[p * ops + seq] counts the deliveries of an item
+  std::vector<std::atomic<uint8_t>> seen(total);
+  for (auto &s : seen) {
+    s.store(0, std::memory_order_relaxed);
+  }
+  std::atomic<uint64_t> received(0);
+  std::atomic<bool> go(false);
+  std::vector<std::thread> producers, consumers;
+
+  for (size_t i = 0; i < opts.producers; ++i) {
+    producers.push_back(std::thread([&, i] {
+      pin_thread(opts, i);
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      item batch[8];
+      uint64_t seq = 0;
+      while (seq < opts.ops) {
+        switch ((seq + i) % 4) {
+        case 0:
+          if (!q.push(item{i, seq, checksum(i, seq)})) {
+            fail(name, "push failed before close");
+          }
+          ++seq;
+          break;
+        case 1:
+          while (!q.try_push(item{i, seq, checksum(i, seq)})) {
+            mpmc::detail::cpu_relax();
+          }
+          ++seq;
+          break;
+        case 2:
+          if (!q.emplace(item{i, seq, checksum(i, seq)})) {
+            fail(name, "emplace failed before close");
+          }
+          ++seq;
+          break;
+        default: {
+          auto const n = std::min<uint64_t>(opts.ops - seq, 1 + seq % 8);
+          for (uint64_t j = 0; j < n; ++j) {
+            batch[j] = item{i, seq + j, checksum(i, seq + j)};
+          }
+          if (seq % 2 == 0) {
+            if (!q.push_n(batch, batch + n)) {
+              fail(name, "push_n failed before close");
+            }
+            seq += n;
+          } else {
+            seq += q.try_push_n(batch, batch + n);
+          }
+          break;
+        }
+        }
+      }
+    }));
+  }
+
+  for (size_t i = 0; i < opts.consumers; ++i) {
+    consumers.push_back(std::thread([&, i] {
+      pin_thread(opts, opts.producers + i);
+      // next[p] is the lowest sequence number still allowed from producer p
+      std::vector<uint64_t> next(opts.producers, 0);
+      auto const check = [&](const item &v) {
+        if (v.producer >= opts.producers || v.seq >= opts.ops ||
+            v.check != checksum(v.producer, v.seq)) {
+          fail(name, "torn item", v);
+        }
+        if (v.seq < next[v.producer]) {
+          fail(name, "item out of order", v);
+        }
+        next[v.producer] = v.seq + 1;
+        if (seen[v.producer * opts.ops + v.seq].fetch_add(1) != 0) {
+          fail(name, "item dequeued twice", v);
+        }
+      };
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      item v, batch[8];
+      uint64_t k = i;
+      for (;; ++k) {
+        size_t n = 0;
+        switch (k % 4) {
+        case 0:
+          if (!q.pop(v)) {
+            // closed and drained
+            return;
+          }
+          check(v);
+          n = 1;
+          break;
+        case 1:
+          if (q.try_pop(v)) {
+            check(v);
+            n = 1;
+          }
+          break;
+        case 2:
+          n = q.try_pop_n(batch, 1 + k % 8);
+          break;
+        default:
+          n = q.try_pop_bulk(batch, 1 + k % 8);
+          break;
+        }
+        if (k % 4 >= 2) {
+          for (size_t j = 0; j < n; ++j) {
+            check(batch[j]);
+          }
+        }
+        received.fetch_add(n, std::memory_order_relaxed);
+        if (n == 0 && q.closed() && q.empty()) {
+          return;
+        }
+      }
+    }));
+  }
+
+  go.store(true, std::memory_order_release);
+  for (auto &t : producers) {
+    t.join();
+  }
+  // the blocking pops of the consumers return once the queue is drained
+  q.close();
+  for (auto &t : consumers) {
+    t.join();
+  }
+
+  if (received.load() != total) {
+    fail(name, "lost items");
+  }
+  for (auto &s : seen) {
+    if (s.load() != 1) {
+      fail(name, "item not dequeued exactly once");
+    }
+  }
+  return total;
+}
+
+template <typename Queue> void run(const char *name, const options &opts) {
+  auto const start = std::chrono::steady_clock::now();
+  uint64_t checked = 0;
+  for (uint64_t r = 0; r < opts.rounds; ++r) {
+    Queue q(opts.capacity);
+    checked += stress_round(name, opts, q);
+  }
+  auto const stop = std::chrono::steady_clock::now();
+  std::printf("%-40s %12llu items %8.2f s\n", name,
+              static_cast<unsigned long long>(checked),
+              std::chrono::duration<double>(stop - start).count());
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  options opts;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--pin") == 0) {
+      opts.pin = true;
+    } else if (std::strncmp(argv[i], "--producers=", 12) == 0) {
+      opts.producers = std::strtoull(argv[i] + 12, nullptr, 10);
+    } else if (std::strncmp(argv[i], "--consumers=", 12) == 0) {
+      opts.consumers = std::strtoull(argv[i] + 12, nullptr, 10);
+    } else if (std::strncmp(argv[i], "--ops=", 6) == 0) {
+      opts.ops = std::strtoull(argv[i] + 6, nullptr, 10);
+    } else if (std::strncmp(argv[i], "--capacity=", 11) == 0) {
+      opts.capacity = std::strtoull(argv[i] + 11, nullptr, 10);
+    } else if (std::strncmp(argv[i], "--rounds=", 9) == 0) {
+      opts.rounds = std::strtoull(argv[i] + 9, nullptr, 10);
+    } else {
+      std::fprintf(stderr,
+                   "usage: %s [--pin] [--producers=N] [--consumers=N] "
+                   "[--ops=N] [--capacity=N] [--rounds=N]\n",
+                   argv[0]);
+      return 1;
+    }
+  }
+  if (opts.producers == 0 || opts.consumers == 0 || opts.ops == 0 ||
+      opts.capacity == 0 || opts.rounds == 0) {
+    std::fprintf(stderr, "all counts must be positive\n");
+    return 1;
+  }
+
+  std::printf("%zu producers, %zu consumers, %u cores\n", opts.producers,
+              opts.consumers, std::thread::hardware_concurrency());
+  run<mpmc::queue<item>>("queue", opts);
+  run<mpmc::queue<item, mpmc::power_of_two_capacity, mpmc::compact_slots>>(
+      "queue<pow2, compact>", opts);
+  run<mpmc::queue<item, mpmc::relaxed_ordering>>("queue<relaxed>", opts);
+  run<mpmc::queue<item, mpmc::relaxed_ordering, mpmc::park_wait>>(
+      "queue<relaxed, park>", opts);
+  run<mpmc::queue<item, mpmc::relaxed_ordering, mpmc::power_of_two_capacity,
+                  mpmc::compact_slots>>("queue<relaxed, pow2, compact>", opts);
+  run<mpmc::queue<item, mpmc::backoff_wait>>("queue<backoff>", opts);
+  run<mpmc::queue<item, mpmc::park_wait>>("queue<park>", opts);
+  run<mpmc::queue<item, mpmc::prefetch_ahead<>>>("queue<prefetch>", opts);
+  run<mpmc::queue<item, mpmc::sharded_stats>>("queue<stats>", opts);
+
+  return 0;
+}
@@ -2,12 +2,23 @@
 
 #include <cassert>
 #include <chrono>
+#include <cstring>
 #include <iostream>
+#include <iterator>
 #include <mpmc/mpmcqueue.hpp>
 #include <set>
+#include <string>
 #include <thread>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>    // O_RDWR
+#include <poll.h>     // poll
+#include <sys/mman.h> // mmap
+#include <sys/wait.h> // waitpid
+#include <unistd.h>   // fork
+#endif
+
 // test_type tracks correct usage of constructors and destructors
 struct test_type {
   static std::set<const test_type *> constructed;
@@ -45,6 +56,292 @@ struct test_type {
 
 std::set<const test_type *> test_type::constructed;
 
+// counting_allocator tracks the allocations not yet freed
+std::atomic<size_t> counting_allocations(0);
+
+template <typename T> struct counting_allocator {
+  using value_type = T;
+  counting_allocator() noexcept = default;
+  template <typename U>
+  counting_allocator(const counting_allocator<U> &) noexcept {}
+  T *allocate(std::size_t n) {
+    auto *p = mpmc::aligned_allocator<T>().allocate(n);
+    ++counting_allocations;
+    return p;
+  }
+  void deallocate(T *p, std::size_t n) {
+    --counting_allocations;
+    mpmc::aligned_allocator<T>().deallocate(p, n);
+  }
+};
+
+// gated_type blocks assignments from a negative value until the gate opens
+std::atomic<bool> gate_open(false);
+
+struct gated_type {
+  gated_type(int x = 0) noexcept : v(x) {}
+  gated_type(const gated_type &) = default;
+  gated_type &operator=(const gated_type &other) noexcept {
+    while (other.v < 0 && !gate_open.load()) {
+      std::this_thread::yield();
+    }
+    v = other.v;
+    return *this;
+  }
+  int v;
+};
+
+// timed operations give up at the deadline and succeed when woken up
+template <typename Queue> void timed_test() {
+  using clock = std::chrono::steady_clock;
+  const auto timeout = std::chrono::milliseconds(20);
+  Queue q(1);
+  int v = 0;
+
+  auto start = clock::now();
+  assert(q.try_pop_for(v, timeout) == false);
+  assert(clock::now() - start >= timeout);
+
+  assert(q.try_push_for(1, timeout) == true);
+  start = clock::now();
+  assert(q.try_push_until(2, start + timeout) == false);
+  assert(clock::now() - start >= timeout);
+
+  assert(q.try_pop_until(v, clock::now() + timeout) == true && v == 1);
+
+  auto t = std::thread([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    q.push(3);
+  });
+  assert(q.try_pop_for(v, std::chrono::seconds(10)) == true && v == 3);
+  t.join();
+}
+
+#if defined(MPMC_HAS_COROUTINES)
+// a coroutine that starts eagerly and destroys itself when done
+struct detached {
+  struct promise_type {
+    detached get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+template <typename Queue>
+detached async_consumer(Queue &q, std::atomic<int> &sum,
+                        std::atomic<int> &done) {
+  while (auto v = co_await q.async_pop()) {
+    sum += *v;
+  }
+  ++done;
+}
+
+template <typename Queue, typename Executor>
+detached async_producer(Queue &q, int v, Executor ex, std::atomic<int> &done) {
+  assert(co_await q.async_push(v, ex));
+  ++done;
+}
+
+// a coroutine that starts eagerly and is destroyed by its owner
+struct owned {
+  struct promise_type {
+    owned get_return_object() noexcept {
+      return {std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+  std::coroutine_handle<promise_type> handle;
+};
+
+template <typename Queue, typename Executor = mpmc::inline_executor>
+owned owned_consumer(Queue &q, int &v, Executor ex = Executor()) {
+  if (auto item = co_await q.async_pop(ex)) {
+    v = *item;
+  }
+}
+
+template <typename Queue> owned owned_producer(Queue &q, int v) {
+  co_await q.async_push(v);
+}
+#endif
+
+// close fails producers, drains the queue and wakes blocked consumers
+template <typename Queue> void close_test() {
+  {
+    Queue q(4);
+    int v = 0;
+    assert(q.push(1) && q.push(2));
+    assert(!q.closed());
+    q.close();
+    q.close();
+    assert(q.closed());
+    assert(!q.push(3) && !q.try_push(4));
+    assert(q.try_push_for(5, std::chrono::seconds(10)) == false);
+    assert(q.size() == 2);
+    assert(q.pop(v) && v == 1);
+    assert(q.try_pop(v) && v == 2);
+    assert(q.size() == 0 && q.empty());
+    assert(!q.pop(v) && !q.try_pop(v));
+    assert(q.try_pop_for(v, std::chrono::seconds(10)) == false);
+    assert(!q.consume([](int &) {}));
+    std::vector<int> out;
+    q.pop_n(std::back_inserter(out), 3);
+    assert(out.empty());
+  }
+
+  // blocked consumers are woken up
+  {
+    Queue q(1);
+    std::vector<std::thread> threads;
+    std::atomic<int> done(0);
+    for (int i = 0; i < 4; ++i) {
+      threads.push_back(std::thread([&] {
+        int v = 0;
+        assert(!q.pop(v));
+        ++done;
+      }));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    assert(done == 0);
+    q.close();
+    for (auto &t : threads) {
+      t.join();
+    }
+    assert(done == 4);
+  }
+
+  // every item pushed before the close is popped
+  {
+    Queue q(8);
+    std::atomic<uint64_t> pushed(0), popped(0);
+    std::vector<std::thread> threads;
+    for (uint64_t i = 0; i < 4; ++i) {
+      threads.push_back(std::thread([&, i] {
+        uint64_t sum = 0;
+        for (auto j = i + 1; q.push(static_cast<int>(j)); j += 4) {
+          sum += j;
+        }
+        pushed += sum;
+      }));
+      threads.push_back(std::thread([&] {
+        uint64_t sum = 0;
+        int v = 0;
+        while (q.pop(v)) {
+          sum += static_cast<uint64_t>(v);
+        }
+        popped += sum;
+      }));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.close();
+    for (auto &t : threads) {
+      t.join();
+    }
+    assert(pushed == popped);
+  }
+}
+
+// message passing test that plain memory written before a push is visible
+// after the pop that gets the item, through the blocking, try and bulk
+// operations. with relaxed_ordering the ticket claims carry no ordering, so
+// the payload is only published by the release store and acquire load of
+// the slot turn, including on the paths where a parked or backing off
+// waiter is woken and on the compact layout. under ThreadSanitizer a
+// missing happens-before edge shows up as a data race on the payload
+template <typename Queue> void message_passing_test() {
+  const size_t num_producers = 2, num_ops = 500;
+  std::vector<uint64_t> payload(num_producers * num_ops, 0);
+  Queue q(8);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_producers; ++i) {
+    threads.push_back(std::thread([&, i] {
+      for (size_t j = 0; j < num_ops; ++j) {
+        auto const idx = i * num_ops + j;
+        payload[idx] = idx + 1;
+        if (j % 2 == 0) {
+          q.push(idx);
+        } else {
+          while (!q.try_push(idx)) {
+            std::this_thread::yield();
+          }
+        }
+      }
+    }));
+  }
+  threads.push_back(std::thread([&] {
+    size_t received = 0, batch[4];
+    while (received < num_producers * num_ops) {
+      size_t n = 0;
+      switch (received % 3) {
+      case 0:
+        assert(q.pop(batch[0]));
+        n = 1;
+        break;
+      case 1:
+        n = q.try_pop_n(batch, 4);
+        break;
+      default:
+        n = q.try_pop_bulk(batch, 4);
+        break;
+      }
+      for (size_t k = 0; k < n; ++k) {
+        assert(payload[batch[k]] == batch[k] + 1);
+      }
+      received += n;
+      if (n == 0) {
+        std::this_thread::yield();
+      }
+    }
+  }));
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+// fuzz test that all elements are enqueued and dequeued under contention
+template <typename Queue>
+void fuzz_test(const uint64_t num_producers = 10,
+               const uint64_t num_consumers = 10) {
+  const uint64_t num_ops = 1000;
+  Queue q(10);
+  std::atomic<bool> flag(false);
+  std::vector<std::thread> threads;
+  std::atomic<uint64_t> sum(0);
+  for (uint64_t i = 0; i < num_producers; ++i) {
+    threads.push_back(std::thread([&, i] {
+      while (!flag)
+        ;
+      for (auto j = i; j < num_ops; j += num_producers) {
+        q.push(j);
+      }
+    }));
+  }
+  for (uint64_t i = 0; i < num_consumers; ++i) {
+    threads.push_back(std::thread([&, i] {
+      while (!flag)
+        ;
+      uint64_t thread_sum = 0;
+      for (auto j = i; j < num_ops; j += num_consumers) {
+        // the queue is never closed, a lost item shows up in the sum
+        uint64_t v = 0;
+        (void)q.pop(v);
+        thread_sum += v;
+      }
+      sum += thread_sum;
+    }));
+  }
+  flag = true;
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  assert(sum == num_ops * (num_ops - 1) / 2);
+}
+
 int main(int argc, char *argv[]) {
   (void)argc, (void)argv;
 
@@ -58,11 +355,11 @@ int main(int argc, char *argv[]) {
     assert(test_type::constructed.size() == 10);
 
     test_type t;
-    q.pop(t);
+    assert(q.pop(t));
     assert(q.size() == 9 && !q.empty());
     assert(test_type::constructed.size() == 10);
 
-    q.pop(t);
+    assert(q.pop(t));
     q.emplace();
     assert(q.size() == 9 && !q.empty());
     assert(test_type::constructed.size() == 10);
@@ -128,42 +425,1506 @@ int main(int argc, char *argv[]) {
     assert(throws == true);
   }
 
-  // fuzz test
+  // power of two capacity rounds up
   {
-    const uint64_t num_ops = 1000;
-    const uint64_t num_threads = 10;
-    mpmc::queue<uint64_t> q(num_threads);
-    std::atomic<bool> flag(false);
+    mpmc::queue<int, mpmc::power_of_two_capacity> q(3);
+    for (int i = 0; i < 4; i++) {
+      assert(q.try_push(i) == true);
+    }
+    assert(q.try_push(4) == false);
+    for (int i = 0; i < 4 * 3; i++) {
+      int t = 0;
+      assert(q.try_pop(t) == true && t == i);
+      assert(q.try_push(i + 4) == true);
+    }
+    assert(q.size() == 4);
+  }
+
+  // static capacity
+  {
+    mpmc::queue<test_type, mpmc::static_capacity<5>> q;
+    for (int i = 0; i < 5; i++) {
+      assert(q.try_emplace() == true);
+    }
+    assert(q.try_emplace() == false);
+    assert(test_type::constructed.size() == 5);
+
+    bool throws = false;
+    try {
+      mpmc::queue<int, mpmc::static_capacity<5>> q2(4);
+    } catch (std::exception &) {
+      throws = true;
+    }
+    assert(throws == true);
+  }
+  assert(test_type::constructed.size() == 0);
+
+  // static queue keeps its slots inline
+  {
+    static_assert(sizeof(mpmc::static_queue<int, 8>) >=
+                      8 * sizeof(mpmc::padded_slots::slot_type<int>),
+                  "static queue must embed its slots");
+    static mpmc::static_queue<int, 8> sq;
+    for (int i = 0; i < 8; i++) {
+      assert(sq.try_push(i));
+    }
+    assert(!sq.try_push(8));
+    int v = 0;
+    for (int i = 0; i < 8; i++) {
+      assert(sq.try_pop(v) && v == i);
+    }
+
+    mpmc::static_queue<test_type, 3, mpmc::compact_slots> q;
+    for (int i = 0; i < 3; i++) {
+      assert(q.try_emplace());
+    }
+    assert(!q.try_emplace());
+    assert(test_type::constructed.size() == 3);
+  }
+  assert(test_type::constructed.size() == 0);
+
+  // prefetching ahead does not change what the queue holds
+  {
+    mpmc::queue<test_type, mpmc::prefetch_ahead<3>> q(4);
+    std::vector<test_type> in(3), out(3);
+    for (int i = 0; i < 7; i++) {
+      assert(q.try_emplace() == (i < 4));
+    }
+    test_type t;
+    assert(q.try_pop(t));
+    assert(q.pop(t));
+    assert(q.try_pop_n(out.begin(), 1) == 1);
+    assert(q.try_pop_bulk(out.begin(), 3) == 1);
+    q.push_n(in.begin(), in.end());
+    q.pop_n(out.begin(), 3);
+    assert(q.empty());
+  }
+  assert(test_type::constructed.size() == 0);
+
+  // compact slots
+  {
+    static_assert(sizeof(mpmc::compact_slots::slot_type<uint64_t>) == 16,
+                  "compact slot for an 8 byte type must take 16 bytes");
+    static_assert(sizeof(mpmc::compact_slots::slot_type<char>) == 16,
+                  "compact slot must be a power of two");
+    static_assert(alignof(mpmc::compact_slots::slot_type<test_type>) ==
+                      alignof(std::atomic<size_t>),
+                  "compact slot larger than a cache line must not be padded");
+
+    // capacity that is remapped and capacity that is not
+    for (size_t capacity : {64, 8, 6}) {
+      mpmc::queue<uint64_t, mpmc::compact_slots> q(capacity);
+      for (uint64_t lap = 0; lap < 3; lap++) {
+        for (uint64_t i = 0; i < capacity; i++) {
+          assert(q.try_push(lap * capacity + i) == true);
+        }
+        assert(q.try_push(0) == false);
+        for (uint64_t i = 0; i < capacity; i++) {
+          uint64_t t = 0;
+          assert(q.try_pop(t) == true && t == lap * capacity + i);
+        }
+        assert(q.empty());
+      }
+    }
+
+    mpmc::queue<test_type, mpmc::compact_slots, mpmc::power_of_two_capacity>
+        q(3);
+    for (int i = 0; i < 3; i++) {
+      q.emplace();
+    }
+    assert(test_type::constructed.size() == 3);
+  }
+  assert(test_type::constructed.size() == 0);
+
+  // trivially copyable items are copied into trivially destructible slots
+  {
+    struct pod {
+      int a;
+      double b;
+    };
+    static_assert(std::is_trivially_destructible<mpmc::slot<pod>>::value,
+                  "slot of trivially copyable type is trivially destructible");
+    static_assert(
+        !std::is_trivially_destructible<mpmc::slot<std::string>>::value,
+        "slot of non-trivial type destroys its item");
+    mpmc::queue<pod, mpmc::compact_slots> q(4);
+    pod p = {1, 2.0};
+    q.push(p);
+    q.emplace(pod{3, 4.0});
+    assert(q.try_push(pod{5, 6.0}));
+    assert(q.pop(p) && p.a == 1 && p.b == 2.0);
+    assert(q.try_pop(p) && p.a == 3 && p.b == 4.0);
+    assert(q.consume([](pod &v) { assert(v.a == 5 && v.b == 6.0); }));
+    // teardown with items left in the queue
+    q.push(p);
+  }
+
+  // batch operations
+  {
+    mpmc::queue<int> q(5);
+    const int in[] = {0, 1, 2, 3, 4, 5, 6};
+    int out[7] = {};
+    q.push_n(in, in + 3);
+    assert(q.size() == 3);
+    assert(q.try_push_n(in + 3, in + 7) == 2);
+    assert(q.size() == 5);
+    assert(q.try_push_n(in, in + 1) == 0);
+    q.pop_n(out, 2);
+    assert(out[0] == 0 && out[1] == 1);
+    assert(q.try_pop_n(out, 7) == 3);
+    assert(out[0] == 2 && out[1] == 3 && out[2] == 4);
+    assert(q.try_pop_n(out, 7) == 0);
+    assert(q.size() == 0 && q.empty());
+
+    // wraps around the end of the ring
+    q.push_n(in, in + 4);
+    std::vector<int> v;
+    q.pop_n(std::back_inserter(v), 4);
+    assert(v == std::vector<int>(in, in + 4));
+  }
+
+  {
+    mpmc::queue<test_type> q(4);
+    std::vector<test_type> in(3);
+    q.push_n(in.begin(), in.end());
+    assert(test_type::constructed.size() == 6);
+    std::vector<test_type> out(4);
+    assert(q.try_pop_n(out.begin(), out.size()) == 3);
+    assert(test_type::constructed.size() == 7);
+  }
+  assert(test_type::constructed.size() == 0);
+
+  // overwrite oldest drops the oldest items and reports the gap
+  {
+    mpmc::queue<int, mpmc::overwrite_oldest> q(4);
+    for (int i = 0; i < 10; ++i) {
+      assert(q.try_push(i));
+    }
+    assert(q.size() == 4 && q.dropped() == 6);
+    int v = 0;
+    mpmc::ticket_type seq = 0;
+    assert(q.pop(v, seq) && v == 6 && seq == 6);
+    assert(q.try_pop(v, seq) && v == 7 && seq == 7);
+    q.push(10);
+    q.push(11);
+    q.push(12);
+    assert(q.dropped() == 7);
+    assert(q.try_pop(v, seq) && v == 9 && seq == 9);
+  }
+
+  {
+    mpmc::queue<test_type, mpmc::overwrite_oldest> q(3);
+    for (int i = 0; i < 10; ++i) {
+      q.emplace();
+    }
+    assert(test_type::constructed.size() == 3 && q.dropped() == 7);
+  }
+  assert(test_type::constructed.size() == 0);
+
+  // overwrite oldest under contention accounts for every item
+  {
+    mpmc::queue<uint64_t, mpmc::overwrite_oldest> q(8);
+    const uint64_t n = 2000;
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> popped(0);
+    std::vector<std::thread> producers, consumers;
+    for (uint64_t i = 0; i < 4; ++i) {
+      producers.push_back(std::thread([&, i] {
+        for (auto j = i; j < n; j += 4) {
+          q.push(j);
+        }
+      }));
+    }
+    for (int i = 0; i < 2; ++i) {
+      consumers.push_back(std::thread([&] {
+        uint64_t v = 0, count = 0;
+        mpmc::ticket_type seq = 0, last = 0;
+        bool first = true;
+        while (!done || !q.empty()) {
+          if (q.try_pop(v, seq)) {
+            assert(first || seq > last);
+            first = false;
+            last = seq;
+            ++count;
+          } else {
+            std::this_thread::yield();
+          }
+        }
+        popped += count;
+      }));
+    }
+    for (auto &t : producers) {
+      t.join();
+    }
+    done = true;
+    for (auto &t : consumers) {
+      t.join();
+    }
+    assert(popped + q.dropped() == n);
+  }
+
+  // broadcast queue hands every item to every subscriber and reuses a slot
+  // only after the slowest subscriber has passed it
+  {
+    mpmc::broadcast_queue<int> q(2, 2);
+    assert(q.capacity() == 2 && q.subscriber_count() == 2);
+    assert(q.try_push(1) && q.try_push(2));
+    assert(!q.try_push(3));
+    int v = 0;
+    assert(q.try_pop(0, v) && v == 1);
+    assert(q.try_pop(0, v) && v == 2);
+    assert(!q.try_pop(0, v) && q.empty(0));
+    assert(!q.try_push(3));
+    assert(q.size(1) == 2);
+    assert(q.try_consume(1, [](const int &item) noexcept { assert(item == 1); }));
+    assert(q.try_push(3) && !q.try_push(4));
+    q.pop(1, v);
+    assert(v == 2);
+    q.pop(1, v);
+    assert(v == 3);
+    q.pop(0, v);
+    assert(v == 3);
+  }
+
+  {
+    mpmc::broadcast_queue<test_type> q(3, 4);
+    for (int i = 0; i < 3; ++i) {
+      q.emplace();
+    }
+    assert(test_type::constructed.size() == 3);
+    for (size_t s = 0; s < q.subscriber_count(); ++s) {
+      for (int i = 0; i < 3; ++i) {
+        assert(q.try_consume(s, [](const test_type &) noexcept {}));
+      }
+    }
+    assert(test_type::constructed.size() == 3);
+    q.emplace();
+    assert(test_type::constructed.size() == 3);
+  }
+  assert(test_type::constructed.size() == 0);
+
+  // broadcast queue under contention keeps per producer order for every
+  // subscriber
+  {
+    mpmc::broadcast_queue<uint64_t, mpmc::park_wait> q(16, 3);
+    const uint64_t n = 2000, producers = 2;
     std::vector<std::thread> threads;
+    for (uint64_t i = 0; i < producers; ++i) {
+      threads.push_back(std::thread([&, i] {
+        for (uint64_t j = 0; j < n; ++j) {
+          q.push(j * producers + i);
+        }
+      }));
+    }
     std::atomic<uint64_t> sum(0);
-    for (uint64_t i = 0; i < num_threads; ++i) {
+    for (size_t s = 0; s < q.subscriber_count(); ++s) {
+      threads.push_back(std::thread([&, s] {
+        std::vector<uint64_t> next(producers, 0);
+        uint64_t total = 0;
+        for (uint64_t j = 0; j < n * producers; ++j) {
+          q.consume(s, [&](const uint64_t &v) noexcept {
+            assert(v / producers == next[v % producers]);
+            ++next[v % producers];
+            total += v;
+          });
+        }
+        sum += total;
+      }));
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    auto const m = n * producers;
+    assert(sum == q.subscriber_count() * (m * (m - 1) / 2));
+  }
+
+  // byte ring keeps messages contiguous and pads around the end of the ring
+  {
+    auto const granule = mpmc::hardware_interference_size;
+    mpmc::byte_ring<> r(4 * granule - 1);
+    assert(r.max_size() == 4 * granule);
+    assert(!r.try_reserve(r.max_size() + 1));
+    const std::string small = "abc", large(granule + 1, 'x');
+    std::string out;
+    auto const copy = [&out](const char *p, size_t n) noexcept {
+      out.assign(p, n);
+    };
+    assert(r.empty());
+    assert(r.try_push(small.data(), small.size()));
+    auto w = r.reserve(large.size());
+    assert(w && w.size() == large.size());
+    assert(reinterpret_cast<uintptr_t>(w.data()) % granule == 0);
+    std::memcpy(w.data(), large.data(), large.size());
+    r.commit(w);
+    assert(!r.try_push(large.data(), large.size()));
+    assert(r.try_consume(copy) && out == small);
+    auto const v = r.try_read();
+    assert(v && std::string(v.data(), v.size()) == large);
+    r.release(v);
+    assert(r.try_push(large.data(), large.size()));
+    assert(r.try_push(small.data(), 0));
+    r.consume(copy);
+    assert(out == large);
+    assert(r.try_consume(copy) && out.empty());
+    assert(!r.try_consume(copy) && r.empty());
+  }
+
+  // byte ring under contention delivers every message intact and in order
+  // per producer
+  {
+    mpmc::byte_ring<mpmc::park_wait> r(1024);
+    const uint32_t n = 1000, producers = 2;
+    std::atomic<uint32_t> received(0);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < producers; ++i) {
       threads.push_back(std::thread([&, i] {
-        while (!flag)
-          ;
-        for (auto j = i; j < num_ops; j += num_threads) {
+        for (uint32_t j = 0; j < n; ++j) {
+          // a header of producer and sequence followed by a fill byte
+          uint32_t const size = 8 + (j * 37) % 300;
+          auto w = r.reserve(size);
+          std::memcpy(w.data(), &i, 4);
+          std::memcpy(w.data() + 4, &j, 4);
+          std::memset(w.data() + 8, static_cast<int>(j & 0xff), size - 8);
+          r.commit(w);
+        }
+      }));
+      threads.push_back(std::thread([&] {
+        std::vector<uint32_t> next(producers, 0);
+        while (received < n * producers) {
+          auto const consumed = r.try_consume([&](const char *p,
+                                                  size_t size) noexcept {
+            uint32_t producer, seq;
+            std::memcpy(&producer, p, 4);
+            std::memcpy(&seq, p + 4, 4);
+            assert(producer < producers && seq >= next[producer]);
+            assert(size == 8 + (seq * 37) % 300);
+            for (size_t k = 8; k < size; ++k) {
+              assert(static_cast<unsigned char>(p[k]) == (seq & 0xff));
+            }
+            next[producer] = seq + 1;
+            ++received;
+          });
+          if (!consumed) {
+            std::this_thread::yield();
+          }
+        }
+      }));
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    assert(received == n * producers && r.empty());
+  }
+
+  // bulk pop drains what is ready without blocking
+  {
+    mpmc::queue<int> q(8);
+    const int in[] = {0, 1, 2, 3, 4};
+    std::vector<int> out;
+    assert(q.try_pop_bulk(std::back_inserter(out), 512) == 0);
+    q.push_n(in, in + 5);
+    assert(q.try_pop_bulk(std::back_inserter(out), 3) == 3);
+    assert(q.try_pop_bulk(std::back_inserter(out), 512) == 2);
+    assert(out == std::vector<int>(in, in + 5));
+    assert(q.try_pop_bulk(std::back_inserter(out), 512) == 0);
+    assert(q.empty());
+  }
+
+  // bulk pop under contention loses no items
+  {
+    mpmc::queue<uint64_t, mpmc::park_wait> q(16);
+    const uint64_t n = 2000;
+    std::atomic<uint64_t> popped(0), sum(0);
+    std::vector<std::thread> threads;
+    for (uint64_t i = 0; i < 2; ++i) {
+      threads.push_back(std::thread([&, i] {
+        for (auto j = i; j < n; j += 2) {
           q.push(j);
         }
       }));
+      threads.push_back(std::thread([&] {
+        uint64_t local = 0, out[512];
+        while (popped < n) {
+          auto const count = q.try_pop_bulk(out, 512);
+          for (size_t j = 0; j < count; ++j) {
+            local += out[j];
+          }
+          if (count == 0) {
+            std::this_thread::yield();
+          }
+          popped += count;
+        }
+        sum += local;
+      }));
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    assert(popped == n && sum == n * (n - 1) / 2);
+  }
+
+  // producer and consumer tokens move items a block at a time
+  {
+    mpmc::queue<int> q(8);
+    {
+      mpmc::queue<int>::producer_token p(q, 4);
+      // a drained queue takes the first item at once
+      assert(p.push(0));
+      assert(p.size() == 0 && q.size() == 1);
+      for (int i = 1; i < 4; ++i) {
+        assert(p.push(i));
+      }
+      assert(p.size() == 3 && q.size() == 1);
+      assert(p.push(4));
+      assert(p.size() == 0 && q.size() == 5);
+      assert(p.try_push(5) && p.size() == 1);
+    }
+    assert(q.size() == 6);
+    mpmc::queue<int>::consumer_token c(q, 2);
+    int v = 0;
+    for (int i = 0; i < 6; ++i) {
+      assert(c.try_pop(v) && v == i);
+    }
+    assert(!c.try_pop(v) && c.size() == 0);
+    q.close();
+    assert(!c.pop(v));
+  }
+
+  // a partial block is invisible until flushed, flush reports the items it
+  // drops after close and held items are taken out through the token
+  {
+    mpmc::queue<int> q(8);
+    int v = 0;
+    q.push(-1);
+    mpmc::queue<int>::producer_token p(q, 4);
+    assert(p.push(0) && p.push(1));
+    assert(p.size() == 2 && q.size() == 1);
+    assert(p.flush() == 0 && p.size() == 0);
+    assert(q.try_pop(v) && v == -1);
+    assert(q.try_pop(v) && v == 0);
+    assert(q.try_pop(v) && v == 1);
+    q.push(2);
+    q.push(3);
+    {
+      mpmc::queue<int>::consumer_token c(q, 4);
+      assert(c.try_pop(v) && v == 2 && c.size() == 1);
+      assert(q.empty());
+      q.push(4);
+      // held items come out before the newer ones in the queue
+      assert(c.try_pop(v) && v == 3 && c.size() == 0);
+      assert(c.try_pop(v) && v == 4);
     }
-    for (uint64_t i = 0; i < num_threads; ++i) {
+    {
+      // held items can be drained in order instead of popped one by one
+      mpmc::queue<int>::consumer_token c(q, 4);
+      q.push(5);
+      q.push(6);
+      q.push(7);
+      assert(c.try_pop(v) && v == 5 && c.size() == 2);
+      std::vector<int> held;
+      assert(c.drain(std::back_inserter(held)) == 2 && c.size() == 0);
+      assert(held.size() == 2 && held[0] == 6 && held[1] == 7);
+    }
+    // items gathered under a backlog are stranded while the producer is
+    // idle until it flushes
+    q.push(8);
+    assert(p.push(9) && p.push(10) && p.size() == 2);
+    assert(q.try_pop(v) && v == 8);
+    assert(!q.try_pop(v) && q.empty());
+    assert(p.flush() == 0);
+    assert(q.try_pop(v) && v == 9);
+    assert(q.try_pop(v) && v == 10);
+    // the queue is only checked for close when a block starts, items
+    // gathered after a close are reported by the flush that drops them
+    q.push(11);
+    assert(p.push(12) && p.size() == 1);
+    q.close();
+    assert(p.push(13) && p.size() == 2);
+    assert(p.flush() == 2 && p.size() == 0);
+    assert(!p.push(14) && p.size() == 0);
+    {
+      mpmc::queue<int>::consumer_token c(q, 4);
+      assert(c.pop(v) && v == 11);
+      assert(!c.pop(v));
+    }
+  }
+
+  {
+    mpmc::queue<test_type> q(4);
+    {
+      mpmc::queue<test_type>::producer_token p(q, 2);
+      for (int i = 0; i < 6; ++i) {
+        assert(p.try_emplace());
+      }
+      assert(!p.try_emplace());
+      assert(q.size() == 4 && p.size() == 2);
+      assert(test_type::constructed.size() == 6);
+      test_type t;
+      mpmc::queue<test_type>::consumer_token c(q, 8);
+      assert(c.try_pop(t) && c.size() == 3);
+      assert(p.try_emplace() && p.size() == 1);
+      while (c.try_pop(t)) {
+      }
+    }
+    assert(test_type::constructed.size() == 1);
+  }
+  assert(test_type::constructed.size() == 0);
+
+  // tokens under contention keep per producer order and lose no items
+  {
+    using queue = mpmc::queue<uint64_t, mpmc::park_wait>;
+    queue q(64);
+    const uint64_t n = 2000, producers = 2;
+    std::atomic<uint64_t> sum(0);
+    std::vector<std::thread> threads;
+    for (uint64_t i = 0; i < producers; ++i) {
+      threads.push_back(std::thread([&, i] {
+        queue::producer_token p(q, 16);
+        for (uint64_t j = 0; j < n; ++j) {
+          p.push(j * producers + i);
+        }
+      }));
+      threads.push_back(std::thread([&] {
+        queue::consumer_token c(q, 16);
+        std::vector<uint64_t> next(producers, 0);
+        uint64_t local = 0, v = 0;
+        while (c.pop(v)) {
+          assert(v / producers >= next[v % producers]);
+          next[v % producers] = v / producers + 1;
+          local += v;
+        }
+        sum += local;
+      }));
+    }
+    threads[0].join();
+    threads[2].join();
+    q.close();
+    threads[1].join();
+    threads[3].join();
+    auto const m = n * producers;
+    assert(sum == m * (m - 1) / 2);
+  }
+
+  // segmented queue
+  {
+    mpmc::segmented_queue<test_type> q(3, 2);
+    for (int lap = 0; lap < 3; lap++) {
+      for (int i = 0; i < 8; i++) {
+        assert(q.try_emplace() == true);
+      }
+      assert(q.try_emplace() == false);
+      assert(q.size() == 8);
+      assert(test_type::constructed.size() == 8);
+      test_type t;
+      for (int i = 0; i < 8; i++) {
+        assert(q.try_pop(t) == true);
+      }
+      assert(q.try_pop(t) == false);
+      assert(q.empty());
+    }
+    for (int i = 0; i < 5; i++) {
+      q.emplace();
+    }
+    assert(test_type::constructed.size() == 5);
+  }
+  assert(test_type::constructed.size() == 0);
+
+  {
+    mpmc::segmented_queue<int, mpmc::compact_slots> q(2, 4);
+    for (int i = 0; i < 100; i++) {
+      q.push(i);
+      q.push(i);
+      int a = 0, b = 0;
+      q.pop(a);
+      assert(q.try_pop(b) == true);
+      assert(a == i && b == i);
+    }
+  }
+
+  // the reader of the last slot of a segment does not wait for slower
+  // readers of the other slots, the last one to finish recycles it
+  {
+    mpmc::segmented_queue<gated_type> q(4, 2);
+    q.push(gated_type(-1));
+    for (int i = 1; i < 4; i++) {
+      q.push(gated_type(i));
+    }
+    std::thread t([&] {
+      gated_type g;
+      q.pop(g);
+      assert(g.v == -1);
+    });
+    while (q.size() != 3) {
+      std::this_thread::yield();
+    }
+    gated_type g;
+    for (int i = 1; i < 4; i++) {
+      assert(q.try_pop(g) && g.v == i);
+    }
+    gate_open = true;
+    t.join();
+    for (int lap = 0; lap < 3; lap++) {
+      for (int i = 0; i < 8; i++) {
+        assert(q.try_push(gated_type(i)));
+      }
+      assert(!q.try_push(gated_type(8)));
+      for (int i = 0; i < 8; i++) {
+        assert(q.try_pop(g) && g.v == i);
+      }
+    }
+  }
+
+  // segmented queue frees the segments beyond max_idle once drained
+  {
+    mpmc::segmented_queue<int, counting_allocator<int>> q(4, 64, 1);
+    assert(counting_allocations == 0);
+    for (int i = 0; i < 100; i++) {
+      q.push(i);
+    }
+    assert(counting_allocations == 25);
+    int v = 0;
+    for (int i = 0; i < 100; i++) {
+      assert(q.try_pop(v) && v == i);
+    }
+    // one idle segment is kept, the next ticket may have installed another
+    assert(counting_allocations <= 2);
+    for (int i = 0; i < 10; i++) {
+      q.push(i);
+      q.pop(v);
+    }
+    assert(counting_allocations <= 2);
+  }
+  assert(counting_allocations == 0);
+
+  // segmented queue recycling small segments under contention
+  {
+    mpmc::segmented_queue<uint64_t, mpmc::park_wait> q(2, 4);
+    const uint64_t num_ops = 2000;
+    std::atomic<uint64_t> sum(0);
+    std::vector<std::thread> threads;
+    for (uint64_t i = 0; i < 4; ++i) {
+      threads.push_back(std::thread([&, i] {
+        for (auto j = i; j < num_ops; j += 4) {
+          if (j % 2 == 0) {
+            q.push(j);
+          } else {
+            while (!q.try_push(j)) {
+              std::this_thread::yield();
+            }
+          }
+        }
+      }));
       threads.push_back(std::thread([&, i] {
-        while (!flag)
-          ;
         uint64_t thread_sum = 0;
-        for (auto j = i; j < num_ops; j += num_threads) {
-          uint64_t v;
-          q.pop(v);
+        for (auto j = i; j < num_ops; j += 4) {
+          uint64_t v = 0;
+          if (j % 2 == 0) {
+            q.pop(v);
+          } else {
+            while (!q.try_pop(v)) {
+              std::this_thread::yield();
+            }
+          }
           thread_sum += v;
         }
         sum += thread_sum;
       }));
     }
-    flag = true;
     for (auto &thread : threads) {
       thread.join();
     }
     assert(sum == num_ops * (num_ops - 1) / 2);
+    assert(q.empty());
+  }
+
+  // single producer and single consumer keep fifo order
+  {
+    mpmc::queue<int, mpmc::single_producer, mpmc::single_consumer,
+                mpmc::park_wait>
+        q(4);
+    assert(q.try_push(1));
+    assert(q.try_push(2));
+    int a[2] = {3, 4};
+    assert(q.try_push_n(a, a + 2) == 2);
+    assert(!q.try_push(5));
+    assert(q.size() == 4);
+    int v = 0;
+    assert(q.try_pop(v) && v == 1);
+    int b[3] = {};
+    assert(q.try_pop_n(b, 3) == 3);
+    assert(b[0] == 2 && b[1] == 3 && b[2] == 4);
+    assert(!q.try_pop(v));
+
+    const int num_ops = 2000;
+    auto t = std::thread([&] {
+      for (int i = 0; i < num_ops; ++i) {
+        if (i % 2 == 0) {
+          q.push(i);
+        } else {
+          while (!q.try_push(i)) {
+            std::this_thread::yield();
+          }
+        }
+      }
+    });
+    for (int i = 0; i < num_ops; ++i) {
+      assert(q.pop(v));
+      assert(v == i);
+    }
+    t.join();
+    assert(q.empty());
+  }
+
+  // in place construction and consumption
+  {
+    mpmc::queue<test_type> q(2);
+    q.emplace_with([](void *p) noexcept { new (p) test_type(); });
+    assert(q.try_emplace_with([](void *p) noexcept { new (p) test_type(); }));
+    assert(!q.try_emplace_with([](void *) noexcept { assert(false); }));
+    assert(test_type::constructed.size() == 2);
+
+    const test_type *seen = nullptr;
+    q.consume([&](test_type &t) noexcept {
+      assert(test_type::constructed.count(&t) == 1);
+      seen = &t;
+    });
+    assert(seen != nullptr && test_type::constructed.count(seen) == 0);
+    assert(q.try_consume([](test_type &) noexcept {}));
+    assert(!q.try_consume([](test_type &) noexcept { assert(false); }));
+    assert(test_type::constructed.size() == 0);
+
+    mpmc::queue<int> p(2);
+    p.emplace_with([](void *v) noexcept { new (v) int(1); });
+    int v = 0;
+    p.consume([&](int &x) noexcept { v = x; });
+    assert(v == 1 && p.empty());
+  }
+  assert(test_type::constructed.size() == 0);
+
+  // occupancy queries
+  {
+    mpmc::queue<int> q(3);
+    assert(q.capacity() == 3 && q.size() == 0 && !q.full());
+    q.push(1);
+    q.push(2);
+    assert(q.approx_size() == 2);
+    q.push(3);
+    assert(q.full() && q.size() == 3 && q.approx_size() == 3);
+    int v = 0;
+    assert(q.pop(v));
+    assert(!q.full() && q.approx_size() == 2);
+
+    // with stats samples are taken every 8 tickets with a capacity of 64
+    mpmc::queue<int, mpmc::power_of_two_capacity, mpmc::sharded_stats> r(64);
+    assert(r.capacity() == 64);
+    for (int i = 0; i < 64; ++i) {
+      r.push(i);
+    }
+    assert(r.full() && r.approx_size() >= 64 - 8);
+    for (int i = 0; i < 30; ++i) {
+      assert(r.pop(v));
+    }
+    assert(r.size() == 34);
+    assert(r.approx_size() + 8 >= 34 && r.approx_size() <= 34 + 8);
+  }
+
+  // stats count failed try operations, spins and occupancy
+  {
+    mpmc::queue<int> p(2);
+    int v = 0;
+    assert(!p.try_pop(v));
+    assert(p.stats().empty == 0);
+
+    mpmc::queue<int, mpmc::sharded_stats> q(2);
+    assert(!q.try_pop(v));
+    assert(q.try_pop_n(&v, 1) == 0);
+    assert(q.try_push(1) && q.try_push(2));
+    assert(!q.try_push(3));
+    assert(q.try_pop(v) && q.try_push(3));
+    auto s = q.stats();
+    assert(s.empty == 2 && s.full == 1 && s.cas_retries == 0);
+    assert(s.high_water_mark == 2);
+
+    auto t = std::thread([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      int w = 0;
+      assert(q.pop(w));
+      assert(q.pop(w));
+    });
+    q.push(4);
+    t.join();
+    assert(q.stats().spin_iterations > 0);
+  }
+
+  // numa allocator binds slots to a node where numa is available
+  auto const numa_node = mpmc::numa_allocator<int>::available() ? 0 : -1;
+  {
+    mpmc::queue<int, mpmc::numa_allocator<int>> q(
+        16, mpmc::numa_allocator<int>(numa_node));
+    assert(q.try_push(1));
+    int v = 0;
+    assert(q.try_pop(v) && v == 1);
+    mpmc::queue<int, mpmc::numa_allocator<int>> r(16);
+    r.push(2);
+    assert(r.pop(v));
+    assert(v == 2);
+  }
+
+  // huge page allocator falls back to transparent huge pages
+  {
+    mpmc::queue<int, mpmc::huge_page_allocator<int>> q(100000);
+    for (int i = 0; i < 3; ++i) {
+      assert(q.try_push(i));
+    }
+    int v = 0;
+    assert(q.try_pop(v) && v == 0);
+    mpmc::queue<int, mpmc::compact_slots, mpmc::huge_page_allocator<int>> r(
+        16, mpmc::huge_page_allocator<int>(4096));
+    r.push(1);
+    assert(r.pop(v));
+    assert(v == 1);
+    bool thrown = false;
+    try {
+      mpmc::huge_page_allocator<int> a(3);
+    } catch (const std::invalid_argument &) {
+      thrown = true;
+    }
+    assert(thrown);
+  }
+
+  // sharded queue pops locally and steals from other shards
+  {
+    mpmc::sharded_queue<int> q(3, 4);
+    assert(q.shard_count() == 3 && q.empty());
+    auto const home = q.home_shard();
+    assert(home < 3);
+    q.shard((home + 1) % 3).push(1);
+    q.shard((home + 2) % 3).push(2);
+    q.push(3);
+    assert(q.size() == 3);
+    int v = 0;
+    assert(q.try_pop(v) && v == 3);
+    assert(q.try_pop(v) && v == 1);
+    q.pop(v);
+    assert(v == 2);
+    assert(!q.try_pop(v));
+
+    mpmc::sharded_queue<int, mpmc::numa_allocator<int>> n(
+        2, 4, [numa_node](size_t) {
+          return mpmc::numa_allocator<int>(numa_node);
+        });
+    n.push(4);
+    n.pop(v);
+    assert(v == 4);
+
+    // threads running at the same time are spread over more than one shard,
+    // by their cpu or round robin where there are fewer cpus than shards
+    {
+      mpmc::sharded_queue<int> s(4, 4);
+      const size_t count = 16;
+      std::atomic<size_t> started(0);
+      std::vector<std::atomic<size_t>> used(s.shard_count());
+      std::vector<std::thread> threads;
+      for (size_t i = 0; i < count; ++i) {
+        threads.push_back(std::thread([&] {
+          started.fetch_add(1);
+          while (started.load() != count) {
+            std::this_thread::yield();
+          }
+          used[s.home_shard()].fetch_add(1);
+        }));
+      }
+      for (auto &t : threads) {
+        t.join();
+      }
+      size_t shards = 0;
+      for (auto &u : used) {
+        shards += u.load() != 0;
+      }
+      assert(shards > 1);
+    }
+
+    // a parked pop is woken by a push to any shard
+    mpmc::sharded_queue<int, mpmc::park_wait> p(2, 4);
+    std::thread t([&] {
+      int w = 0;
+      for (int i = 0; i < 100; ++i) {
+        p.pop(w);
+        assert(w == i);
+      }
+    });
+    for (int i = 0; i < 100; ++i) {
+      std::this_thread::sleep_for(std::chrono::microseconds(10));
+      p.push(i);
+    }
+    t.join();
+  }
+
+  // priority queue pops the highest priority lane first
+  {
+    mpmc::priority_queue<int, 3> q(4);
+    int v = 0;
+    assert(q.empty() && !q.try_pop(v));
+    q.push(2, 20);
+    q.push(1, 10);
+    q.push(2, 21);
+    assert(q.try_push(0, 0));
+    assert(q.size() == 4);
+    assert(q.try_pop(v) && v == 0);
+    assert(q.try_pop(v) && v == 10);
+    q.push(0, 1);
+    assert(q.try_pop(v) && v == 1);
+    assert(q.try_pop(v) && v == 20);
+    q.pop(v);
+    assert(v == 21);
+    assert(!q.try_pop(v) && q.empty());
+  }
+
+  // weighted priority queue follows the weights and skips empty lanes
+  {
+    mpmc::priority_queue<int, 2> q(8, {2, 1});
+    for (int i = 0; i < 4; ++i) {
+      q.push(0, i);
+      q.push(1, 10 + i);
+    }
+    std::vector<int> order;
+    int v = 0;
+    while (q.try_pop(v)) {
+      order.push_back(v);
+    }
+    assert(order.size() == 8);
+    size_t low = 0;
+    for (size_t i = 0; i < 6; ++i) {
+      low += order[i] >= 10 ? 1 : 0;
+    }
+    assert(low == 2);
+    bool thrown = false;
+    try {
+      mpmc::priority_queue<int, 2> r(8, {1});
+    } catch (const std::invalid_argument &) {
+      thrown = true;
+    }
+    assert(thrown);
+  }
+
+  // priority queue under contention loses no items
+  {
+    mpmc::priority_queue<uint64_t, 4, mpmc::backoff_wait> q(4);
+    const uint64_t num_ops = 2000;
+    std::atomic<uint64_t> sum(0);
+    std::vector<std::thread> threads;
+    for (uint64_t i = 0; i < 2; ++i) {
+      threads.push_back(std::thread([&, i] {
+        for (auto j = i; j < num_ops; j += 2) {
+          q.push(j % 4, j);
+        }
+      }));
+      threads.push_back(std::thread([&] {
+        uint64_t thread_sum = 0;
+        for (uint64_t j = 0; j < num_ops / 2; ++j) {
+          uint64_t v = 0;
+          q.pop(v);
+          thread_sum += v;
+        }
+        sum += thread_sum;
+      }));
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    assert(sum == num_ops * (num_ops - 1) / 2);
+    assert(q.empty());
+  }
+
+  // a parked priority pop is woken by a push to any lane
+  {
+    mpmc::priority_queue<int, 2, mpmc::park_wait> q(4);
+    std::thread t([&] {
+      int v = 0;
+      for (int i = 0; i < 100; ++i) {
+        q.pop(v);
+        assert(v == i);
+      }
+    });
+    for (int i = 0; i < 100; ++i) {
+      std::this_thread::sleep_for(std::chrono::microseconds(10));
+      q.push(static_cast<size_t>(i % 2), i);
+    }
+    t.join();
+  }
+
+  // pool recycles a fixed set of objects and runs out when they are in use
+  {
+    mpmc::pool<test_type> p(4);
+    assert(p.capacity() == 4);
+    std::vector<test_type *> objects;
+    for (int i = 0; i < 4; ++i) {
+      objects.push_back(p.create());
+      assert(objects.back() != nullptr);
+    }
+    assert(p.create() == nullptr);
+    assert(test_type::constructed.size() == 4);
+    for (auto o : objects) {
+      p.destroy(o);
+    }
+    assert(test_type::constructed.empty());
+    {
+      auto o = p.make();
+      assert(o && test_type::constructed.size() == 1);
+    }
+    assert(test_type::constructed.empty());
+  }
+
+  // pooled objects travel through a queue and back without allocating
+  {
+    using pool_type = mpmc::pool<std::string>;
+    pool_type p(256);
+    mpmc::queue<pool_type::pointer, mpmc::park_wait> q(16);
+    const int n = 2000;
+    auto t = std::thread([&] {
+      for (int i = 0; i < n; ++i) {
+        auto o = p.make(std::to_string(i));
+        assert(o);
+        q.push(std::move(o));
+      }
+    });
+    for (int i = 0; i < n; ++i) {
+      assert(q.consume([&](pool_type::pointer &o) {
+        assert(*o == std::to_string(i));
+        o.reset();
+      }));
+    }
+    t.join();
+  }
+
+  // blocks freed by a consumer thread are available to the producer again,
+  // small pools skip the magazines and larger ones take blocks from the
+  // magazines of other threads
+  for (size_t capacity : {16, 32, 128}) {
+    mpmc::pool<int> p(capacity);
+    mpmc::queue<int *> q(capacity);
+    for (int lap = 0; lap < 3; ++lap) {
+      auto t = std::thread([&] {
+        for (size_t i = 0; i < capacity; ++i) {
+          int *o = nullptr;
+          assert(q.pop(o));
+          p.destroy(o);
+        }
+      });
+      for (size_t i = 0; i < capacity; ++i) {
+        auto o = p.create(static_cast<int>(i));
+        assert(o != nullptr);
+        q.push(o);
+      }
+      t.join();
+    }
+  }
+
+  // work stealing deque pops lifo, steals fifo and fills up
+  {
+    mpmc::work_stealing_deque<int> d(3);
+    assert(d.capacity() == 4);
+    int v = 0;
+    assert(!d.pop(v) && !d.steal(v));
+    for (int i = 0; i < 4; ++i) {
+      assert(d.push(i));
+    }
+    assert(!d.push(4));
+    assert(d.size() == 4);
+    assert(d.pop(v) && v == 3);
+    assert(d.steal(v) && v == 0);
+    assert(d.pop(v) && v == 2);
+    assert(d.steal(v) && v == 1);
+    assert(d.empty() && !d.pop(v) && !d.steal(v));
+  }
+
+  // work stealing deque hands every item to exactly one thread
+  {
+    mpmc::work_stealing_deque<uint64_t> d(64);
+    const uint64_t n = 10000;
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> sum(0);
+    std::vector<std::thread> thieves;
+    for (int i = 0; i < 3; ++i) {
+      thieves.push_back(std::thread([&] {
+        uint64_t local = 0, v = 0;
+        while (!done || !d.empty()) {
+          if (d.steal(v)) {
+            local += v;
+          } else {
+            std::this_thread::yield();
+          }
+        }
+        sum += local;
+      }));
+    }
+    uint64_t local = 0, v = 0;
+    for (uint64_t i = 1; i <= n; ++i) {
+      while (!d.push(i)) {
+        if (d.pop(v)) {
+          local += v;
+        }
+      }
+      if (i % 3 == 0 && d.pop(v)) {
+        local += v;
+      }
+    }
+    while (d.pop(v)) {
+      local += v;
+    }
+    done = true;
+    for (auto &t : thieves) {
+      t.join();
+    }
+    sum += local;
+    assert(sum == n * (n + 1) / 2);
+  }
+
+  // scheduler runs every task submitted from outside and from tasks
+  {
+    std::atomic<uint64_t> count(0);
+    {
+      mpmc::scheduler<> s(4, 64, 64);
+      assert(s.worker_count() == 4);
+      for (int i = 0; i < 1000; ++i) {
+        s.submit([&] {
+          for (int j = 0; j < 10; ++j) {
+            s.submit([&] { ++count; });
+          }
+          ++count;
+        });
+      }
+    }
+    assert(count == 11000);
+  }
+
+  // scheduled tasks embed their task and allocate nothing
+  {
+    struct counter : mpmc::task {
+      counter() : mpmc::task(&invoke), runs(0) {}
+      static void invoke(mpmc::task *t) { ++static_cast<counter *>(t)->runs; }
+      std::atomic<int> runs;
+    };
+    std::vector<counter> counters(100);
+    {
+      mpmc::scheduler<mpmc::backoff_wait> s(2);
+      for (auto &c : counters) {
+        s.schedule(&c);
+      }
+    }
+    for (auto &c : counters) {
+      assert(c.runs == 1);
+    }
+  }
+
+#if defined(__unix__) || defined(__APPLE__)
+  // notifier makes the handle readable on the first publish after arming
+  {
+    mpmc::queue<int, mpmc::fd_notifier> q(4);
+    auto readable = [&] {
+      pollfd p = {q.native_handle(), POLLIN, 0};
+      return poll(&p, 1, 0) == 1;
+    };
+    int v = 0;
+    assert(!readable());
+    q.push(1);
+    assert(!readable());
+    assert(!q.arm());
+    assert(q.pop(v) && v == 1);
+    assert(q.arm());
+    assert(!readable());
+    q.push(2);
+    q.push(3);
+    assert(readable());
+    q.acknowledge();
+    assert(!readable());
+    assert(q.pop(v) && v == 2 && q.pop(v) && v == 3);
+    assert(q.arm());
+    q.close();
+    assert(readable());
+    assert(!q.arm());
+  }
+
+  // consumer in a poll loop receives every item
+  {
+    mpmc::queue<int, mpmc::fd_notifier> q(16);
+    const int n = 2000;
+    auto t = std::thread([&] {
+      for (int i = 0; i < n; ++i) {
+        q.push(i);
+      }
+    });
+    int next = 0, v = 0;
+    while (next < n) {
+      while (q.try_pop(v)) {
+        assert(v == next);
+        ++next;
+      }
+      if (next < n && q.arm()) {
+        pollfd p = {q.native_handle(), POLLIN, 0};
+        assert(poll(&p, 1, 10000) == 1);
+        q.acknowledge();
+      }
+    }
+    t.join();
   }
 
+  // interprocess queue is shared through a named segment
+  {
+    using queue = mpmc::interprocess_queue<uint64_t, mpmc::backoff_wait>;
+    auto const name = "/mpmc_queue_test_" + std::to_string(getpid());
+    queue::remove(name);
+    auto q = queue::create(name, 4);
+    assert(q.capacity() == 4 && q.empty());
+    bool thrown = false;
+    try {
+      queue::create(name, 4);
+    } catch (const std::system_error &) {
+      thrown = true;
+    }
+    assert(thrown);
+    thrown = false;
+    try {
+      mpmc::interprocess_queue<uint32_t>::open(name);
+    } catch (const std::runtime_error &) {
+      thrown = true;
+    }
+    assert(thrown);
+
+    // a corrupt capacity in the header is rejected, also one whose size in
+    // bytes overflows. the capacity is the fifth field of the header, after
+    // the magic, version, slot size and value size
+    {
+      auto const fd = shm_open(name.c_str(), O_RDWR, 0600);
+      assert(fd != -1);
+      auto *h = static_cast<unsigned char *>(
+          mmap(nullptr, 32, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+      assert(h != MAP_FAILED);
+      close(fd);
+      uint64_t good = 0;
+      std::memcpy(&good, h + 24, sizeof(good));
+      assert(good == 4);
+      for (uint64_t bad : {uint64_t(0), uint64_t(5), uint64_t(1) << 62}) {
+        std::memcpy(h + 24, &bad, sizeof(bad));
+        thrown = false;
+        try {
+          queue::open(name);
+        } catch (const std::runtime_error &) {
+          thrown = true;
+        }
+        assert(thrown);
+      }
+      std::memcpy(h + 24, &good, sizeof(good));
+      munmap(h, 32);
+    }
+
+    auto r = queue::open(name);
+    assert(q.try_push(1));
+    uint64_t v = 0;
+    assert(r.try_pop(v) && v == 1);
+    assert(!r.try_pop(v));
+
+    const uint64_t num_ops = 1000;
+    auto const pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+      auto c = queue::open(name);
+      for (uint64_t i = 0; i < num_ops; ++i) {
+        c.push(i);
+      }
+      _exit(0);
+    }
+    for (uint64_t i = 0; i < num_ops; ++i) {
+      q.pop(v);
+      assert(v == i);
+    }
+    int status = 0;
+    assert(waitpid(pid, &status, 0) == pid && status == 0);
+    assert(queue::remove(name));
+    assert(!queue::remove(name));
+  }
+#endif
+
+  // blocking operations park and are woken up
+  {
+    mpmc::queue<int, mpmc::park_wait> q(1);
+    auto t = std::thread([&] {
+      int v = 0;
+      assert(q.pop(v));
+      assert(v == 1);
+      assert(q.pop(v));
+      assert(v == 2);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    q.push(1);
+    q.push(2);
+    t.join();
+    assert(q.empty());
+  }
+
+#if defined(MPMC_HAS_COROUTINES)
+  // coroutines wait for items and slots without blocking the thread
+  {
+    mpmc::queue<int, mpmc::coroutine_wait> q(2);
+    std::atomic<int> sum(0), done(0);
+    for (int i = 0; i < 1000; ++i) {
+      async_consumer(q, sum, done);
+    }
+    assert(q.size() == -1000);
+    for (int i = 1; i <= 3000; ++i) {
+      q.push(i);
+    }
+    assert(sum == 3000 * 3001 / 2 && done == 0);
+    q.close();
+    assert(done == 1000);
+  }
+
+  // suspended producers are resumed through the executor
+  {
+    mpmc::queue<int, mpmc::coroutine_wait> q(2);
+    std::vector<std::coroutine_handle<>> runnable;
+    auto executor = [&](std::coroutine_handle<> h) { runnable.push_back(h); };
+    std::atomic<int> done(0);
+    for (int i = 0; i < 10; ++i) {
+      async_producer(q, i, executor, done);
+    }
+    // the first capacity items complete synchronously
+    assert(done == 2 && runnable.empty());
+    int v = 0, sum = 0;
+    while (done != 10) {
+      assert(q.pop(v));
+      sum += v;
+      while (!runnable.empty()) {
+        auto h = runnable.back();
+        runnable.pop_back();
+        h.resume();
+      }
+    }
+    while (q.try_pop(v)) {
+      sum += v;
+    }
+    assert(sum == 45);
+  }
+
+  // coroutines waiting on later turns of the same slot are only resumed
+  // when their turn comes
+  {
+    mpmc::queue<int, mpmc::coroutine_wait> q(1);
+    std::vector<std::coroutine_handle<>> runnable;
+    auto executor = [&](std::coroutine_handle<> h) { runnable.push_back(h); };
+    int v[3] = {0, 0, 0};
+    auto c0 = owned_consumer(q, v[0], executor);
+    auto c1 = owned_consumer(q, v[1], executor);
+    auto c2 = owned_consumer(q, v[2], executor);
+    for (int i = 1; i <= 3; ++i) {
+      q.push(i);
+      assert(runnable.size() == 1);
+      runnable.back().resume();
+      runnable.clear();
+      assert(v[i - 1] == i);
+    }
+    assert(c0.handle.done() && c1.handle.done() && c2.handle.done());
+    c0.handle.destroy();
+    c1.handle.destroy();
+    c2.handle.destroy();
+  }
+
+  // coroutines and threads wait on the same queue
+  {
+    mpmc::queue<int, mpmc::coroutine_wait> q(4);
+    std::atomic<int> sum(0), done(0);
+    for (int i = 0; i < 100; ++i) {
+      async_consumer(q, sum, done);
+    }
+    std::vector<std::thread> producers;
+    for (int i = 0; i < 4; ++i) {
+      producers.push_back(std::thread([&, i] {
+        for (int j = i; j < 2000; j += 4) {
+          q.push(j);
+        }
+      }));
+    }
+    for (auto &t : producers) {
+      t.join();
+    }
+    q.close();
+    assert(done == 100 && sum == 2000 * 1999 / 2);
+  }
+
+  // coroutines destroyed while suspended give up their tickets without
+  // wedging the queue
+  {
+    mpmc::queue<int, mpmc::coroutine_wait> q(1);
+    int v = 0;
+    auto c = owned_consumer(q, v);
+    assert(!c.handle.done() && q.size() == -1);
+    c.handle.destroy();
+    // the item of the abandoned ticket is destroyed, the next one gets through
+    q.push(1);
+    q.push(2);
+    assert(q.pop(v) && v == 2);
+
+    // the item of an abandoned push is still enqueued once its slot is free
+    q.push(3);
+    auto p = owned_producer(q, 4);
+    assert(!p.handle.done());
+    p.handle.destroy();
+    assert(q.pop(v) && v == 3);
+    assert(q.pop(v) && v == 4);
+
+    // an abandoned ticket the close comes before is released by the close
+    c = owned_consumer(q, v);
+    c.handle.destroy();
+    q.close();
+    assert(q.empty() && !q.try_pop(v));
+  }
+  {
+    // destroyed after its item arrived but before the executor resumed it
+    mpmc::queue<int, mpmc::coroutine_wait> q(2);
+    std::vector<std::coroutine_handle<>> runnable;
+    auto executor = [&](std::coroutine_handle<> h) { runnable.push_back(h); };
+    int v = 0;
+    auto c = owned_consumer(q, v, executor);
+    q.push(5);
+    assert(runnable.size() == 1 && !c.handle.done());
+    runnable.clear();
+    c.handle.destroy();
+    assert(q.empty() && v == 0);
+    q.push(6);
+    assert(q.pop(v) && v == 6);
+  }
+#endif
+
+  timed_test<mpmc::queue<int>>();
+  timed_test<mpmc::queue<int, mpmc::backoff_wait>>();
+  timed_test<mpmc::queue<int, mpmc::park_wait>>();
+
+  close_test<mpmc::queue<int>>();
+  close_test<mpmc::queue<int, mpmc::backoff_wait>>();
+  close_test<mpmc::queue<int, mpmc::park_wait>>();
+
+  message_passing_test<mpmc::queue<size_t>>();
+  message_passing_test<mpmc::queue<size_t, mpmc::relaxed_ordering>>();
+  message_passing_test<
+      mpmc::queue<size_t, mpmc::relaxed_ordering, mpmc::backoff_wait>>();
+  message_passing_test<
+      mpmc::queue<size_t, mpmc::relaxed_ordering, mpmc::park_wait>>();
+  message_passing_test<mpmc::queue<size_t, mpmc::relaxed_ordering,
+                                   mpmc::power_of_two_capacity,
+                                   mpmc::compact_slots>>();
+
+  fuzz_test<mpmc::queue<uint64_t>>();
+  fuzz_test<mpmc::queue<uint64_t, mpmc::backoff_wait>>();
+  fuzz_test<mpmc::queue<uint64_t, mpmc::park_wait>>();
+  fuzz_test<mpmc::segmented_queue<uint64_t, mpmc::park_wait>>();
+  fuzz_test<mpmc::queue<uint64_t, mpmc::relaxed_ordering,
+                        mpmc::backoff_wait>>();
+  fuzz_test<mpmc::queue<uint64_t, mpmc::single_producer,
+                        mpmc::single_consumer, mpmc::backoff_wait>>(1, 1);
+  fuzz_test<mpmc::queue<uint64_t, mpmc::single_producer,
+                        mpmc::backoff_wait>>(1, 10);
+  fuzz_test<mpmc::queue<uint64_t, mpmc::single_consumer,
+                        mpmc::backoff_wait>>(10, 1);
+
   return 0;
 }